@@ -0,0 +1,325 @@
+#include "gpb1_bank.h"
+#include <cmath>
+
+const double GPB1Bank::kMaxStep = 0.1;
+
+namespace {
+
+// yaw is the only angle of the common state
+const int kYawMask = 1 << 3;
+
+// the radar model reads [px py v yaw]
+const int kRadarInputs = 4;
+
+typedef GPB1Bank::StateSigmaMatrix StateSigmaMatrix;
+typedef GPB1Bank::CtraFilter::PredictionType<GPB1Bank::kRadar>::type::SigmaMatrix RadarSigmaMatrix;
+
+/**
+ * Log likelihood of a measurement of dimension n_z with the given NIS and log |S|
+ */
+double LogLikelihood(double nis, double log_det_S, int n_z) {
+    return -0.5 * (nis + log_det_S + n_z * log(2.0 * M_PI));
+}
+
+/**
+ * Transforms the predicted sigma points of filter into its radar prediction.
+ * A column with the same [px py v yaw] as the same column of an earlier
+ * model (both come from the same prior point) or as the center column
+ * reuses that measurement instead of evaluating h(x) again.
+ * @param Xsig_prev Predicted sigma points of the n_prev earlier models
+ * @param Zsig_prev Radar sigma points of the n_prev earlier models
+ */
+template <class Filter>
+void PredictRadar(Filter &filter, const StateSigmaMatrix *const *Xsig_prev,
+                  const RadarSigmaMatrix *const *Zsig_prev, int n_prev,
+                  long *transformed, long *reused) {
+    static_assert(int(Filter::kStateDim) == int(GPB1Bank::kStateDim), "models share the state layout");
+
+    if (!filter.sigma_points_valid()) {
+        filter.RefreshSigmaPoints();
+    }
+    const RadarModel &radar = filter.template measurement_model<GPB1Bank::kRadar>();
+    const StateSigmaMatrix &Xsig = filter.Xsig_pred_;
+    RadarSigmaMatrix &Zsig = filter.template predicted_measurement<GPB1Bank::kRadar>().Zsig_;
+
+    Zsig.resize(int(RadarModel::kDim), filter.n_sig_);
+    for (int i = 0; i < filter.n_sig_; i++) {
+        bool found = false;
+        for (int m = 0; m < n_prev && !found; m++) {
+            if (Xsig_prev[m]->col(i).head<kRadarInputs>() == Xsig.col(i).head<kRadarInputs>()) {
+                Zsig.col(i) = Zsig_prev[m]->col(i);
+                found = true;
+            }
+        }
+        if (!found && i > 0 && Xsig.col(0).head<kRadarInputs>() == Xsig.col(i).head<kRadarInputs>()) {
+            Zsig.col(i) = Zsig.col(0);
+            found = true;
+        }
+        if (found) {
+            (*reused)++;
+        }
+        else {
+            Zsig.col(i) = radar(Xsig.col(i));
+            (*transformed)++;
+        }
+    }
+
+    filter.template PredictMeasurementMoments<GPB1Bank::kRadar>();
+}
+
+}  // namespace
+
+GPB1Bank::GPB1Bank(SigmaPoints::Type sigma_type)
+    : is_initialized_(false),
+      x_(StateVector::Zero()),
+      P_(StateMatrix::Identity()),
+      NIS_radar_(0),
+      NIS_laser_(0),
+      transformed_points_(0),
+      reused_points_(0),
+      cv_(SigmaPoints(sigma_type, CvFilter::kAugDim,
+                      sigma_type == SigmaPoints::SYMMETRIC ? 3 - kStateDim : 0.0)),
+      ctrv_(SigmaPoints(sigma_type, CtrvFilter::kAugDim,
+                        sigma_type == SigmaPoints::SYMMETRIC ? 3 - kStateDim : 0.0)),
+      ctra_(SigmaPoints(sigma_type, CtraFilter::kAugDim,
+                        sigma_type == SigmaPoints::SYMMETRIC ? 3 - kStateDim : 0.0)),
+      time_us_(0),
+      mean_point_(-1),
+      is_acceleration_point_(ctra_.n_sig_, false) {
+    mu_ << 1.0 / 3, 1.0 / 3, 1.0 / 3;
+
+    // with a lower triangular square root of P, a unit point that is zero but in the
+    // last (acceleration) row moves only the acceleration of the sigma point
+    const Eigen::MatrixXd U = SigmaPoints(sigma_type, CtraFilter::kAugDim,
+                                          sigma_type == SigmaPoints::SYMMETRIC ? 3 - kStateDim : 0.0).UnitPoints();
+    for (int i = 0; i < U.cols(); i++) {
+        const bool acceleration_only = U.col(i).head<kStateDim - 1>().isZero(0)
+                                       && U.col(i).tail<CtraFilter::kNoiseDim>().isZero(0);
+        if (acceleration_only && U(kStateDim - 1, i) == 0 && mean_point_ < 0) {
+            mean_point_ = i;
+        }
+        else if (acceleration_only) {
+            acceleration_points_.push_back(i);
+        }
+    }
+    if (mean_point_ < 0) {
+        acceleration_points_.clear();
+    }
+    for (size_t k = 0; k < acceleration_points_.size(); k++) {
+        is_acceleration_point_[acceleration_points_[k]] = true;
+    }
+
+    // models mostly persist, switching to each other model with 2.5%
+    transition_ << 0.95 , 0.025, 0.025,
+                   0.025, 0.95 , 0.025,
+                   0.025, 0.025, 0.95;
+
+    SetNoise(0.5, 0.5, 0.5);
+
+    // same sensors as UKF
+    RadarModel radar;
+    radar.SetNoise(0.3, 0.0175, 0.15);
+    LidarModel laser;
+    laser.SetNoise(0.08, 0.08);
+    SetSensors(radar, laser);
+}
+
+GPB1Bank::~GPB1Bank() {}
+
+void GPB1Bank::SetNoise(double std_a, double std_j, double std_yawdd) {
+    cv_.SetProcessNoise(CvFilter::NoiseVector(std_a, std_yawdd));
+    ctrv_.SetProcessNoise(CtrvFilter::NoiseVector(std_a, std_yawdd));
+    ctra_.SetProcessNoise(CtraFilter::NoiseVector(std_j, std_yawdd));
+}
+
+void GPB1Bank::SetSensors(const RadarModel &radar, const LidarModel &laser) {
+    cv_.measurement_model<kRadar>() = ctrv_.measurement_model<kRadar>() = ctra_.measurement_model<kRadar>() = radar;
+    cv_.measurement_model<kLaser>() = ctrv_.measurement_model<kLaser>() = ctra_.measurement_model<kLaser>() = laser;
+}
+
+void GPB1Bank::ProcessMeasurement(const MeasurementPackage &meas_package) {
+    if (!is_initialized_) {
+        // Initialize all models with the position of the first measurement
+        x_.setZero();
+        if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
+            double ro = meas_package.raw_measurements_(0);
+            double phi = meas_package.raw_measurements_(1);
+            x_(0) = ro * cos(phi);
+            x_(1) = ro * sin(phi);
+        }
+        else {
+            x_(0) = meas_package.raw_measurements_(0);
+            x_(1) = meas_package.raw_measurements_(1);
+        }
+        P_.setIdentity();
+
+        cv_.x_ = ctrv_.x_ = ctra_.x_ = x_;
+        cv_.P_ = ctrv_.P_ = ctra_.P_ = P_;
+
+        time_us_ = meas_package.timestamp_;
+        is_initialized_ = true;
+        return;
+    }
+
+    // measurements at the same time skip the prediction
+    double dt = (meas_package.timestamp_ - time_us_) / 1000000.0;
+    if (dt >= 1e-4) {
+        time_us_ = meas_package.timestamp_;
+        Predict(dt);
+    }
+
+    // model likelihoods, in log space to avoid underflow
+    ModelVector log_l;
+    ModelVector nis;
+    if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
+        UpdateRadar(meas_package, &log_l, &nis);
+    }
+    else {
+        UpdateLaser(meas_package, &log_l, &nis);
+    }
+
+    ModelVector l = (log_l.array() - log_l.maxCoeff()).exp().matrix();
+    mu_ = mu_.cwiseProduct(l);
+    mu_ /= mu_.sum();
+
+    int best;
+    mu_.maxCoeff(&best);
+    if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
+        NIS_radar_ = nis(best);
+    }
+    else {
+        NIS_laser_ = nis(best);
+    }
+
+    Combine(mu_, &x_, &P_);
+}
+
+void GPB1Bank::Predict(double delta_t) {
+    // predicted model probabilities c_j = sum_i p_ij mu_i
+    mu_ = transition_.transpose() * mu_;
+
+    // every model starts from the combined estimate; all filters have the
+    // same sigma point set, so one factorization gives the points of all
+    cv_.x_ = ctrv_.x_ = ctra_.x_ = x_;
+    cv_.P_ = ctrv_.P_ = ctra_.P_ = P_;
+    StateSigmaMatrix Xsig_state(int(kStateDim), ctra_.n_sig_);
+    ctra_.GenerateStateSigmaPoints(&Xsig_state);
+
+    CvFilter::AugmentedSigmaMatrix Xsig_cv(int(CvFilter::kAugDim), cv_.n_sig_);
+    CtrvFilter::AugmentedSigmaMatrix Xsig_ctrv(int(CtrvFilter::kAugDim), ctrv_.n_sig_);
+    CtraFilter::AugmentedSigmaMatrix Xsig_ctra(int(CtraFilter::kAugDim), ctra_.n_sig_);
+    cv_.AugmentSigmaPoints(Xsig_state, &Xsig_cv);
+    ctrv_.AugmentSigmaPoints(Xsig_state, &Xsig_ctrv);
+    ctra_.AugmentSigmaPoints(Xsig_state, &Xsig_ctra);
+
+    // steps of kMaxStep / 2 while longer than kMaxStep, as UnscentedFilter::Prediction
+    {
+        ObservedStage stage(ctra_.stage_observer(), StageObserver::kSigmaPointPrediction);
+        for (; delta_t > kMaxStep; delta_t -= 0.5 * kMaxStep) {
+            Step(0.5 * kMaxStep, Xsig_cv, Xsig_ctrv, Xsig_ctra);
+            Xsig_cv.topRows<kStateDim>() = cv_.Xsig_pred_;
+            Xsig_ctrv.topRows<kStateDim>() = ctrv_.Xsig_pred_;
+            Xsig_ctra.topRows<kStateDim>() = ctra_.Xsig_pred_;
+        }
+        Step(delta_t, Xsig_cv, Xsig_ctrv, Xsig_ctra);
+    }
+    cv_.CompletePrediction();
+    ctrv_.CompletePrediction();
+    ctra_.CompletePrediction();
+}
+
+void GPB1Bank::Step(double delta_t, const CvFilter::AugmentedSigmaMatrix &Xsig_cv,
+                    const CtrvFilter::AugmentedSigmaMatrix &Xsig_ctrv, const CtraFilter::AugmentedSigmaMatrix &Xsig_ctra) {
+    for (int i = 0; i < ctra_.n_sig_; i++) {
+        // the sines and cosines of the heading are evaluated once for the models
+        // whose point has the same heading (and turn rate), always in the first step,
+        // and for CTRV and CTRA, which turn alike, in the following steps
+        const HeadingTrig trig(Xsig_ctra(3, i), Xsig_ctra(4, i), delta_t);
+        if (!is_acceleration_point_[i]) {
+            if (Xsig_cv(3, i) == Xsig_ctra(3, i)) {
+                cv_.Xsig_pred_.col(i) = cv_.process_model()(Xsig_cv.col(i), delta_t, trig);
+            }
+            else {
+                cv_.Xsig_pred_.col(i) = cv_.process_model()(Xsig_cv.col(i), delta_t);
+            }
+            if (Xsig_ctrv(3, i) == Xsig_ctra(3, i) && Xsig_ctrv(4, i) == Xsig_ctra(4, i)) {
+                ctrv_.Xsig_pred_.col(i) = ctrv_.process_model()(Xsig_ctrv.col(i), delta_t, trig);
+            }
+            else {
+                ctrv_.Xsig_pred_.col(i) = ctrv_.process_model()(Xsig_ctrv.col(i), delta_t);
+            }
+        }
+        ctra_.Xsig_pred_.col(i) = ctra_.process_model()(Xsig_ctra.col(i), delta_t, trig);
+    }
+
+    // CV and CTRV pass the acceleration through: these points move like the mean
+    // point and keep their own acceleration
+    for (size_t k = 0; k < acceleration_points_.size(); k++) {
+        const int i = acceleration_points_[k];
+        cv_.Xsig_pred_.col(i) = cv_.Xsig_pred_.col(mean_point_);
+        cv_.Xsig_pred_(kStateDim - 1, i) = Xsig_cv(kStateDim - 1, i);
+        ctrv_.Xsig_pred_.col(i) = ctrv_.Xsig_pred_.col(mean_point_);
+        ctrv_.Xsig_pred_(kStateDim - 1, i) = Xsig_ctrv(kStateDim - 1, i);
+    }
+}
+
+void GPB1Bank::UpdateRadar(const MeasurementPackage &meas_package, ModelVector* log_l, ModelVector* nis) {
+    const RadarModel::Vector z = meas_package.raw_measurements_;
+    const StateSigmaMatrix* Xsig_prev[kModels] = {&cv_.Xsig_pred_, &ctrv_.Xsig_pred_, &ctra_.Xsig_pred_};
+    const RadarSigmaMatrix* Zsig_prev[kModels] = {&cv_.predicted_measurement<kRadar>().Zsig_,
+                                                  &ctrv_.predicted_measurement<kRadar>().Zsig_,
+                                                  &ctra_.predicted_measurement<kRadar>().Zsig_};
+    double log_det_S;
+
+    // an update leaves Xsig_pred_ and Zsig_ as they are, so later models can reuse them
+    PredictRadar(cv_, Xsig_prev, Zsig_prev, kCv, &transformed_points_, &reused_points_);
+    (*nis)(kCv) = cv_.UpdateState<kRadar>(z, &log_det_S);
+    (*log_l)(kCv) = LogLikelihood((*nis)(kCv), log_det_S, RadarModel::kDim);
+
+    PredictRadar(ctrv_, Xsig_prev, Zsig_prev, kCtrv, &transformed_points_, &reused_points_);
+    (*nis)(kCtrv) = ctrv_.UpdateState<kRadar>(z, &log_det_S);
+    (*log_l)(kCtrv) = LogLikelihood((*nis)(kCtrv), log_det_S, RadarModel::kDim);
+
+    PredictRadar(ctra_, Xsig_prev, Zsig_prev, kCtra, &transformed_points_, &reused_points_);
+    (*nis)(kCtra) = ctra_.UpdateState<kRadar>(z, &log_det_S);
+    (*log_l)(kCtra) = LogLikelihood((*nis)(kCtra), log_det_S, RadarModel::kDim);
+}
+
+void GPB1Bank::UpdateLaser(const MeasurementPackage &meas_package, ModelVector* log_l, ModelVector* nis) {
+    const LidarModel::Vector z = meas_package.raw_measurements_;
+    double log_det_S;
+
+    (*nis)(kCv) = cv_.UpdateLinear<kLaser>(z, &log_det_S);
+    (*log_l)(kCv) = LogLikelihood((*nis)(kCv), log_det_S, LidarModel::kDim);
+
+    (*nis)(kCtrv) = ctrv_.UpdateLinear<kLaser>(z, &log_det_S);
+    (*log_l)(kCtrv) = LogLikelihood((*nis)(kCtrv), log_det_S, LidarModel::kDim);
+
+    (*nis)(kCtra) = ctra_.UpdateLinear<kLaser>(z, &log_det_S);
+    (*log_l)(kCtra) = LogLikelihood((*nis)(kCtra), log_det_S, LidarModel::kDim);
+}
+
+void GPB1Bank::Combine(const ModelVector &weights, StateVector* x_out, StateMatrix* P_out) const {
+    const StateVector* xs[kModels] = {&cv_.x_, &ctrv_.x_, &ctra_.x_};
+    const StateMatrix* Ps[kModels] = {&cv_.P_, &ctrv_.P_, &ctra_.P_};
+
+    // mean relative to the most likely model, so yaw is averaged without wrapping
+    int ref;
+    weights.maxCoeff(&ref);
+    StateVector x = *xs[ref];
+    for (int i = 0; i < kModels; i++) {
+        StateVector diff = *xs[i] - *xs[ref];
+        NormalizeAngles<kYawMask>(diff);
+        x += weights(i) * diff;
+    }
+
+    StateMatrix P = StateMatrix::Zero();
+    for (int i = 0; i < kModels; i++) {
+        StateVector diff = *xs[i] - x;
+        NormalizeAngles<kYawMask>(diff);
+        P += weights(i) * (*Ps[i] + diff * diff.transpose());
+    }
+
+    *x_out = x;
+    *P_out = P;
+}
@@ -0,0 +1,169 @@
+#ifndef GPB1_BANK_H_
+#define GPB1_BANK_H_
+
+#include <vector>
+#include "measurement_package.h"
+#include "sigma_points.h"
+#include "process_models.h"
+#include "measurement_models.h"
+#include "unscented_filter.h"
+#include "Eigen/Dense"
+
+/**
+ * First order generalized pseudo-Bayesian (GPB1) bank of CV, CTRV and CTRA
+ * unscented filters on the common state [px py v yaw yawd a].
+ *
+ * After every update the models are combined into one estimate, and every
+ * prediction starts all models from it. Unlike an IMM, the models keep no
+ * state of their own between measurements and there is no per-model mixing;
+ * in exchange all filters use one sigma point set of the same augmented
+ * dimension, so one Cholesky factorization and one set of state sigma
+ * points serve the whole bank. The sines and cosines of the heading of a
+ * sigma point are evaluated once for the models that move it from the same
+ * heading: all three in the first process step of a prediction, CTRV and
+ * CTRA, which turn alike, in the following ones. CV and CTRV do not read the
+ * acceleration, so their points that differ from the mean only in it are
+ * copied from the mean instead of predicted. The models share the state
+ * layout, so the radar transform h(x) of a predicted sigma point is
+ * computed once for equal [px py v yaw], within a model and across models.
+ */
+class GPB1Bank {
+public:
+    ///* indices of the models
+    enum {
+        kCv = 0,
+        kCtrv = 1,
+        kCtra = 2,
+        kModels = 3
+    };
+
+    ///* indices of the measurement models
+    enum {
+        kRadar = 0,
+        kLaser = 1
+    };
+
+    typedef UnscentedFilter<PaddedModel<CvModel, 1>, RadarModel, LidarModel> CvFilter;
+    typedef UnscentedFilter<PaddedModel<CtrvModel, 1>, RadarModel, LidarModel> CtrvFilter;
+    typedef UnscentedFilter<CtraModel, RadarModel, LidarModel> CtraFilter;
+
+    enum { kStateDim = CtraFilter::kStateDim };
+
+    typedef CtraFilter::StateVector StateVector;
+    typedef CtraFilter::StateMatrix StateMatrix;
+    typedef CtraFilter::StateSigmaMatrix StateSigmaMatrix;
+    typedef Eigen::Matrix<double, kModels, 1> ModelVector;
+    typedef Eigen::Matrix<double, kModels, kModels> ModelMatrix;
+
+    ///* initially set to false, set to true in first call of ProcessMeasurement
+    bool is_initialized_;
+
+    ///* combined state vector: [px py v yaw yawd a]
+    StateVector x_;
+
+    ///* combined state covariance matrix
+    StateMatrix P_;
+
+    ///* model probabilities
+    ModelVector mu_;
+
+    ///* Markov transition probabilities, row i: from model i
+    ModelMatrix transition_;
+
+    ///* the current NIS for radar and laser, of the most likely model
+    double NIS_radar_;
+    double NIS_laser_;
+
+    ///* radar sigma points transformed with h(x), and those that reused another result
+    long transformed_points_;
+    long reused_points_;
+
+    ///* the filters of the bank
+    CvFilter cv_;
+    CtrvFilter ctrv_;
+    CtraFilter ctra_;
+
+    /**
+     * Constructor
+     * @param sigma_type Sigma point strategy shared by all models
+     */
+    explicit GPB1Bank(SigmaPoints::Type sigma_type = SigmaPoints::SYMMETRIC);
+
+    /**
+     * Destructor
+     */
+    virtual ~GPB1Bank();
+
+    /**
+     * ProcessMeasurement Predicts and updates all models from the combined
+     * estimate, then combines them again
+     * @param meas_package The latest measurement data of either radar or laser
+     */
+    void ProcessMeasurement(const MeasurementPackage &meas_package);
+
+    /**
+     * SetNoise Sets the process noise of the models and the sensor noise
+     * @param std_a Longitudinal acceleration noise of CV and CTRV in m/s^2
+     * @param std_j Longitudinal jerk noise of CTRA in m/s^3
+     * @param std_yawdd Yaw acceleration noise of CV, CTRV and CTRA in rad/s^2
+     */
+    void SetNoise(double std_a, double std_j, double std_yawdd);
+
+    /**
+     * SetSensors Sets the sensor noise of all models
+     */
+    void SetSensors(const RadarModel &radar, const LidarModel &laser);
+
+    /**
+     * Longest single prediction step in s, longer intervals move the shared
+     * sigma points in steps of half of it
+     */
+    static const double kMaxStep;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+    /**
+     * Combine Weighted mean and covariance of the model estimates, including
+     * the spread of the means; the yaw differences are normalized
+     */
+    void Combine(const ModelVector &weights, StateVector* x_out, StateMatrix* P_out) const;
+
+    /**
+     * Predict Predicts every model by delta_t from the sigma points of the
+     * combined estimate
+     */
+    void Predict(double delta_t);
+
+    /**
+     * Step Moves the augmented sigma points of every model by one process step
+     * into Xsig_pred_
+     */
+    void Step(double delta_t, const CvFilter::AugmentedSigmaMatrix &Xsig_cv,
+              const CtrvFilter::AugmentedSigmaMatrix &Xsig_ctrv, const CtraFilter::AugmentedSigmaMatrix &Xsig_ctra);
+
+    /**
+     * UpdateRadar Updates every model with a radar measurement
+     * @param log_l Receives the log likelihood of every model
+     * @param nis Receives the NIS of every model
+     */
+    void UpdateRadar(const MeasurementPackage &meas_package, ModelVector* log_l, ModelVector* nis);
+
+    /**
+     * UpdateLaser Updates every model with a laser measurement
+     * @param log_l Receives the log likelihood of every model
+     * @param nis Receives the NIS of every model
+     */
+    void UpdateLaser(const MeasurementPackage &meas_package, ModelVector* log_l, ModelVector* nis);
+
+    // time when the state is true, in us
+    long long time_us_;
+
+    // sigma points that differ from the mean point only in the acceleration,
+    // zero or two of them depending on the sigma point set, and the mean point
+    std::vector<int> acceleration_points_;
+    int mean_point_;
+    std::vector<bool> is_acceleration_point_;
+};
+
+#endif /* GPB1_BANK_H_ */
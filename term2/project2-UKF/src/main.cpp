@@ -5,6 +5,7 @@
 #include "Eigen/Dense"
 #include "ukf.h"
 #include "ground_truth_package.h"
+#include "output_writer.h"
 
 using namespace std;
 using Eigen::MatrixXd;
@@ -14,7 +15,7 @@ using std::vector;
 void check_arguments(int argc, char* argv[]) {
     string usage_instructions = "Usage instructions: ";
     usage_instructions += argv[0];
-    usage_instructions += " path/to/input.txt output.txt";
+    usage_instructions += " [--gpb1] [--simplex] path/to/input.txt output.txt|output.bin [noise.cfg]";
 
     bool has_valid_args = false;
 
@@ -23,9 +24,9 @@ void check_arguments(int argc, char* argv[]) {
         cerr << usage_instructions << endl;
     } else if (argc == 2) {
         cerr << "Please include an output file.\n" << usage_instructions << endl;
-    } else if (argc == 3) {
+    } else if (argc == 3 || argc == 4) {
         has_valid_args = true;
-    } else if (argc > 3) {
+    } else if (argc > 4) {
         cerr << "Too many arguments.\n" << usage_instructions << endl;
     }
 
@@ -35,13 +36,13 @@ void check_arguments(int argc, char* argv[]) {
 }
 
 void check_files(ifstream& in_file, string& in_name,
-                 ofstream& out_file, string& out_name) {
+                 OutputWriter& out_file, string& out_name) {
     if (!in_file.is_open()) {
         cerr << "Cannot open input file: " << in_name << endl;
         exit(EXIT_FAILURE);
     }
 
-    if (!out_file.is_open()) {
+    if (!out_file.Open(out_name)) {
         cerr << "Cannot open output file: " << out_name << endl;
         exit(EXIT_FAILURE);
     }
@@ -49,13 +50,36 @@ void check_files(ifstream& in_file, string& in_name,
 
 int main(int argc, char* argv[]) {
 
+    // before the file names, --gpb1 filters with the CV, CTRV and CTRA bank and
+    // --simplex with the spherical simplex sigma points
+    bool use_bank = false;
+    SigmaPoints::Type sigma_type = SigmaPoints::SYMMETRIC;
+    while (argc > 1 && (string(argv[1]) == "--gpb1" || string(argv[1]) == "--simplex")) {
+        if (string(argv[1]) == "--gpb1") {
+            use_bank = true;
+        } else {
+            sigma_type = SigmaPoints::SPHERICAL_SIMPLEX;
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+
     check_arguments(argc, argv);
 
     string in_file_name_ = argv[1];
     ifstream in_file_(in_file_name_.c_str(), ifstream::in);
 
+    // column names for output file
+    const char* columns[] = {"px", "py", "v", "yaw_angle", "yaw_rate",
+                             "px_measured", "py_measured",
+                             "px_true", "py_true", "vx_true", "vy_true",
+                             "NIS_laser", "NIS_radar"};
+
+    // text, or binary columns for a file name ending in .bin
     string out_file_name_ = argv[2];
-    ofstream out_file_(out_file_name_.c_str(), ofstream::out);
+    OutputWriter out_file_(vector<string>(columns, columns + sizeof(columns) / sizeof(columns[0])),
+                           OutputWriter::FormatFor(out_file_name_));
 
     check_files(in_file_, in_file_name_, out_file_, out_file_name_);
 
@@ -67,64 +91,18 @@ int main(int argc, char* argv[]) {
     vector<GroundTruthPackage> gt_pack_list;
 
     // Create a UKF instance
-    UKF ukf;
-
-    string line;
-    // prep the measurement packages (each line represents a measurement at timestamp)
-    while (getline(in_file_, line)) {
-        string sensor_type;
-        MeasurementPackage meas_package;
-        GroundTruthPackage gt_package;
-        istringstream iss(line);
-        long long timestamp;
-
-        // reads first element from the current line
-        iss >> sensor_type;
-
-        if (sensor_type.compare("L") == 0) {
-            if (!ukf.use_laser_) {
-                continue;
-            }
-            // laser measurement
-            // read measurements at this timestamp
-            meas_package.sensor_type_ = MeasurementPackage::LASER;
-            meas_package.raw_measurements_ = VectorXd(2);
-            float px, py;
-            iss >> px;
-            iss >> py;
-            meas_package.raw_measurements_ << px, py;
-            iss >> timestamp;
-            meas_package.timestamp_ = timestamp;
-            measurement_pack_list.push_back(meas_package);
-        } else if (sensor_type.compare("R") == 0) {
-            if (!ukf.use_radar_) {
-                continue;
-            }
-            // radar measurement
-            // read measurements at this timestamp
-            meas_package.sensor_type_ = MeasurementPackage::RADAR;
-            meas_package.raw_measurements_ = VectorXd(3);
-            float ro, phi, ro_dot;
-            iss >> ro;
-            iss >> phi;
-            iss >> ro_dot;
-            meas_package.raw_measurements_ << ro, phi, ro_dot;
-            iss >> timestamp;
-            meas_package.timestamp_ = timestamp;
-            measurement_pack_list.push_back(meas_package);
-        }
+    UKF ukf(sigma_type);
+    ukf.use_bank_ = use_bank;
 
-        // read ground truth data to compare later
-        float x_gt, y_gt, vx_gt, vy_gt;
-        iss >> x_gt;
-        iss >> y_gt;
-        iss >> vx_gt;
-        iss >> vy_gt;
-        gt_package.gt_values_ = VectorXd(4);
-        gt_package.gt_values_ << x_gt, y_gt, vx_gt, vy_gt;
-        gt_pack_list.push_back(gt_package);
+    // optional process noise, e.g. tuned by TuneNoise
+    if (argc == 4 && !ukf.LoadConfig(argv[3])) {
+        exit(EXIT_FAILURE);
     }
 
+    Tools tools;
+    tools.ReadMeasurements(in_file_, ukf.use_laser_, ukf.use_radar_,
+                           &measurement_pack_list, &gt_pack_list);
+
     // used to compute the RMSE later
     vector<VectorXd> estimations;
     vector<VectorXd> ground_truth;
@@ -133,62 +111,47 @@ int main(int argc, char* argv[]) {
 
     size_t number_of_measurements = measurement_pack_list.size();
 
-    // column names for output file
-    out_file_ << "px" << "\t";
-    out_file_ << "py" << "\t";
-    out_file_ << "v" << "\t";
-    out_file_ << "yaw_angle" << "\t";
-    out_file_ << "yaw_rate" << "\t";
-    out_file_ << "px_measured" << "\t";
-    out_file_ << "py_measured" << "\t";
-    out_file_ << "px_true" << "\t";
-    out_file_ << "py_true" << "\t";
-    out_file_ << "vx_true" << "\t";
-    out_file_ << "vy_true" << "\t";
-    out_file_ << "NIS_laser" << "\t";
-    out_file_ << "NIS_radar" << "\n";
-
-
     for (size_t k = 0; k < number_of_measurements; k++) {
         // Call the UKF-based fusion
         ukf.ProcessMeasurement(measurement_pack_list[k]);
 
         // output the estimation
-        out_file_ << ukf.x_(0) << "\t"; // pos1 - est
-        out_file_ << ukf.x_(1) << "\t"; // pos2 - est
-        out_file_ << ukf.x_(2) << "\t"; // vel_abs -est
-        out_file_ << ukf.x_(3) << "\t"; // yaw_angle -est
-        out_file_ << ukf.x_(4) << "\t"; // yaw_rate -est
+        out_file_.Add(ukf.x_(0)); // pos1 - est
+        out_file_.Add(ukf.x_(1)); // pos2 - est
+        out_file_.Add(ukf.x_(2)); // vel_abs -est
+        out_file_.Add(ukf.x_(3)); // yaw_angle -est
+        out_file_.Add(ukf.x_(4)); // yaw_rate -est
 
         // output the measurements
         if (measurement_pack_list[k].sensor_type_ == MeasurementPackage::LASER) {
-            // output the estimation
+            // output the estimation, parsed as float
             // p1 - meas
-            out_file_ << measurement_pack_list[k].raw_measurements_(0) << "\t";
+            out_file_.Add(static_cast<float>(measurement_pack_list[k].raw_measurements_(0)));
             // p2 - meas
-            out_file_ << measurement_pack_list[k].raw_measurements_(1) << "\t";
+            out_file_.Add(static_cast<float>(measurement_pack_list[k].raw_measurements_(1)));
         } else if (measurement_pack_list[k].sensor_type_ == MeasurementPackage::RADAR) {
             // output the estimation in the cartesian coordinates
             float ro = static_cast<float>(measurement_pack_list[k].raw_measurements_(0));
             float phi = static_cast<float>(measurement_pack_list[k].raw_measurements_(1));
-            out_file_ << ro * cos(phi) << "\t"; // p1_meas
-            out_file_ << ro * sin(phi) << "\t"; // p2_meas
+            out_file_.Add(ro * cos(phi)); // p1_meas
+            out_file_.Add(ro * sin(phi)); // p2_meas
         }
 
-        // output the ground truth packages
-        out_file_ << gt_pack_list[k].gt_values_(0) << "\t";
-        out_file_ << gt_pack_list[k].gt_values_(1) << "\t";
-        out_file_ << gt_pack_list[k].gt_values_(2) << "\t";
-        out_file_ << gt_pack_list[k].gt_values_(3) << "\t";
+        // output the ground truth packages, parsed as float
+        out_file_.Add(static_cast<float>(gt_pack_list[k].gt_values_(0)));
+        out_file_.Add(static_cast<float>(gt_pack_list[k].gt_values_(1)));
+        out_file_.Add(static_cast<float>(gt_pack_list[k].gt_values_(2)));
+        out_file_.Add(static_cast<float>(gt_pack_list[k].gt_values_(3)));
 
         // output the NIS values
         if (measurement_pack_list[k].sensor_type_ == MeasurementPackage::LASER) {
-            out_file_ << ukf.NIS_laser_ << "\t";
-            out_file_ << "N/A" << "\n";
+            out_file_.Add(ukf.NIS_laser_);
+            out_file_.AddMissing();
         } else if (measurement_pack_list[k].sensor_type_ == MeasurementPackage::RADAR) {
-            out_file_ << "N/A" << "\t";
-            out_file_ << ukf.NIS_radar_ << "\n";
+            out_file_.AddMissing();
+            out_file_.Add(ukf.NIS_radar_);
         }
+        out_file_.EndRow();
 
         // convert ukf x vector to cartesian to compare to ground truth
         VectorXd ukf_x_cartesian_ = VectorXd(4);
@@ -206,12 +169,23 @@ int main(int argc, char* argv[]) {
     }
 
     // compute the accuracy (RMSE)
-    Tools tools;
     cout << "Accuracy - RMSE:" << endl << tools.CalculateRMSE(estimations, ground_truth) << endl;
 
+    // NIS consistency over the last window of each sensor
+    const NISMonitor* monitors[] = {&ukf.nis_laser_monitor_, &ukf.nis_radar_monitor_};
+    const char* sensors[] = {"laser", "radar"};
+    for (int i = 0; i < 2; i++) {
+        cout << "NIS " << sensors[i] << " - above 95% threshold " << monitors[i]->Threshold() << ": "
+             << monitors[i]->ExceedanceRate() * 100 << "%, mean " << monitors[i]->Mean()
+             << ", " << NISMonitor::StatusName(monitors[i]->GetStatus()) << endl;
+        if (monitors[i]->NonFinite() > 0) {
+            cout << "NIS " << sensors[i] << " - " << monitors[i]->NonFinite() << " non-finite samples skipped" << endl;
+        }
+    }
+
     // close files
-    if (out_file_.is_open()) {
-        out_file_.close();
+    if (!out_file_.Close()) {
+        cerr << "Cannot write output file: " << out_file_name_ << endl;
     }
 
     if (in_file_.is_open()) {
@@ -0,0 +1,110 @@
+#ifndef MEASUREMENT_MODELS_H_
+#define MEASUREMENT_MODELS_H_
+
+#include <cmath>
+#include "Eigen/Dense"
+
+/**
+ * Measurement models for UnscentedFilter.
+ *
+ * A measurement model declares the measurement dimension kDim and the bit
+ * mask kAngles of the components that are angles, holds the measurement
+ * noise covariance R_ and maps a state to the measurement space with
+ * operator(). Linear models also provide the measurement matrix H<N>().
+ * The models only read [px py v yaw], so they work with any state that
+ * starts with these components.
+ */
+
+/**
+ * Radar measurement: [rho phi rho_dot]
+ */
+struct RadarModel {
+    enum {
+        kDim = 3,
+        kAngles = 1 << 1
+    };
+
+    typedef Eigen::Matrix<double, kDim, 1> Vector;
+    typedef Eigen::Matrix<double, kDim, kDim> NoiseMatrix;
+
+    ///* measurement noise covariance matrix
+    NoiseMatrix R_;
+
+    RadarModel() : R_(NoiseMatrix::Zero()) {}
+
+    /**
+     * SetNoise Sets R from the standard deviations of radius, angle and radius change
+     */
+    void SetNoise(double std_radr, double std_radphi, double std_radrd) {
+        R_ <<   std_radr * std_radr, 0                      , 0,
+                0                  , std_radphi * std_radphi, 0,
+                0                  , 0                      , std_radrd * std_radrd;
+    }
+
+    template <typename Derived>
+    Vector operator()(const Eigen::MatrixBase<Derived> &x) const {
+        // extract values for better readibility
+        double p_x = x(0);
+        double p_y = x(1);
+        double v  = x(2);
+        double yaw = x(3);
+
+        double v1 = cos(yaw)*v;
+        double v2 = sin(yaw)*v;
+
+        // measurement model
+        Vector z;
+        z(0) = sqrt(p_x*p_x + p_y*p_y);                        //r
+        z(1) = atan2(p_y,p_x);                                 //phi
+
+        if (z(0) < 0.001) {
+            z(2) = (p_x * v1 + p_y * v2) / 0.001;              //r_dot
+        } else {
+            z(2) = (p_x * v1 + p_y * v2) / z(0);               //r_dot
+        }
+        return z;
+    }
+};
+
+/**
+ * Laser measurement: [px py]
+ */
+struct LidarModel {
+    enum {
+        kDim = 2,
+        kAngles = 0
+    };
+
+    typedef Eigen::Matrix<double, kDim, 1> Vector;
+    typedef Eigen::Matrix<double, kDim, kDim> NoiseMatrix;
+
+    ///* measurement noise covariance matrix
+    NoiseMatrix R_;
+
+    LidarModel() : R_(NoiseMatrix::Zero()) {}
+
+    /**
+     * SetNoise Sets R from the standard deviations of both positions
+     */
+    void SetNoise(double std_laspx, double std_laspy) {
+        R_ <<   std_laspx * std_laspx, 0,
+                0                    , std_laspy * std_laspy;
+    }
+
+    template <typename Derived>
+    Vector operator()(const Eigen::MatrixBase<Derived> &x) const {
+        return x.template head<kDim>();
+    }
+
+    /**
+     * H Measurement matrix for a state of dimension N, the model is linear
+     */
+    template <int N>
+    Eigen::Matrix<double, kDim, N> H() const {
+        Eigen::Matrix<double, kDim, N> H = Eigen::Matrix<double, kDim, N>::Zero();
+        H.template leftCols<kDim>().setIdentity();
+        return H;
+    }
+};
+
+#endif /* MEASUREMENT_MODELS_H_ */
@@ -0,0 +1,108 @@
+#include "nis_monitor.h"
+#include <cmath>
+#include <stdexcept>
+
+// 95% quantiles of the chi-square distribution for 1 to 5 degrees of freedom
+static const double kChiSquare95[] = {3.841, 5.991, 7.815, 9.488, 11.070};
+static const int kMaxDegreesOfFreedom = sizeof(kChiSquare95) / sizeof(kChiSquare95[0]);
+
+/**
+ * Checks the constructor arguments before any member uses them.
+ * @return n_z
+ */
+static int CheckArguments(int n_z, int window, int n_buckets, double max_nis) {
+    if (n_z < 1 || n_z > kMaxDegreesOfFreedom) {
+        throw std::invalid_argument("NISMonitor: n_z must be 1 to 5");
+    }
+    if (window < 1 || n_buckets < 1 || !(max_nis > 0.0)) {
+        throw std::invalid_argument("NISMonitor: window, n_buckets and max_nis must be positive");
+    }
+    return n_z;
+}
+
+NISMonitor::NISMonitor(int n_z, int window, int n_buckets, double max_nis)
+    : n_z_(CheckArguments(n_z, window, n_buckets, max_nis)),
+      threshold_(kChiSquare95[n_z - 1]),
+      bucket_width_(max_nis / n_buckets),
+      samples_(window, 0.0),
+      head_(0),
+      size_(0),
+      total_(0),
+      non_finite_(0),
+      histogram_(n_buckets, 0),
+      exceedances_(0),
+      sum_(0.0) {}
+
+NISMonitor::~NISMonitor() {}
+
+void NISMonitor::Add(double nis) {
+    // a diverged update gives NaN or inf, which has no bucket and would poison the sum
+    if (!std::isfinite(nis)) {
+        non_finite_++;
+        return;
+    }
+
+    int window = static_cast<int>(samples_.size());
+
+    // drop the oldest sample once the window is full
+    if (size_ == window) {
+        double old = samples_[head_];
+        histogram_[Bucket(old)]--;
+        if (old > threshold_) exceedances_--;
+        sum_ -= old;
+    }
+    else {
+        size_++;
+    }
+
+    samples_[head_] = nis;
+    head_ = (head_ + 1) % window;
+    total_++;
+
+    histogram_[Bucket(nis)]++;
+    if (nis > threshold_) exceedances_++;
+    sum_ += nis;
+}
+
+double NISMonitor::ExceedanceRate() const {
+    return size_ > 0 ? static_cast<double>(exceedances_) / size_ : 0.0;
+}
+
+double NISMonitor::Mean() const {
+    return size_ > 0 ? sum_ / size_ : 0.0;
+}
+
+NISMonitor::Status NISMonitor::GetStatus() const {
+    if (size_ < static_cast<int>(samples_.size())) {
+        return WARMING_UP;
+    }
+
+    // three sigma bands of the window estimates for a consistent filter:
+    // exceedances are binomial(size, 0.05), NIS has mean n_z and variance 2 n_z
+    double rate_limit = 0.05 + 3.0 * sqrt(0.05 * 0.95 / size_);
+    double mean_limit = n_z_ - 3.0 * sqrt(2.0 * n_z_ / size_);
+
+    if (ExceedanceRate() > rate_limit) {
+        return OVERCONFIDENT;
+    }
+    if (Mean() < mean_limit) {
+        return UNDERCONFIDENT;
+    }
+    return CONSISTENT;
+}
+
+const char* NISMonitor::StatusName(Status status) {
+    switch (status) {
+        case WARMING_UP:     return "warming up";
+        case CONSISTENT:     return "consistent";
+        case OVERCONFIDENT:  return "overconfident (noise too small)";
+        case UNDERCONFIDENT: return "underconfident (noise too large)";
+    }
+    return "";
+}
+
+int NISMonitor::Bucket(double nis) const {
+    int last = static_cast<int>(histogram_.size()) - 1;
+    int bucket = static_cast<int>(nis / bucket_width_);
+    return bucket < 0 ? 0 : (bucket > last ? last : bucket);
+}
@@ -0,0 +1,98 @@
+#ifndef NIS_MONITOR_H_
+#define NIS_MONITOR_H_
+
+#include <vector>
+
+/**
+ * Streaming consistency check of the normalized innovation squared (NIS) of
+ * one sensor. For a consistent filter NIS follows a chi-square distribution
+ * with n_z degrees of freedom, so about 5% of the samples exceed the 95%
+ * quantile. The monitor keeps a histogram, the exceedance rate and the mean
+ * over a sliding window of the latest samples; every update is O(1).
+ */
+class NISMonitor {
+public:
+    enum Status {
+        ///* fewer samples than the window size
+        WARMING_UP,
+        ///* exceedance rate and mean NIS agree with the chi-square distribution
+        CONSISTENT,
+        ///* too many exceedances, the noise parameters are too small
+        OVERCONFIDENT,
+        ///* mean NIS too low, the noise parameters are too large
+        UNDERCONFIDENT
+    };
+
+    /**
+     * Constructor
+     * @param n_z Measurement dimension (degrees of freedom), 1 to 5
+     * @param window Number of latest samples the statistics are computed over
+     * @param n_buckets Number of histogram buckets
+     * @param max_nis Upper end of the histogram range, larger values go to the last bucket
+     * @throws std::invalid_argument for n_z outside 1 to 5 or a non-positive size
+     */
+    NISMonitor(int n_z, int window = 100, int n_buckets = 20, double max_nis = 20.0);
+
+    /**
+     * Destructor
+     */
+    virtual ~NISMonitor();
+
+    /**
+     * Add Records one NIS sample, NaN and infinite samples are only counted
+     * @param nis Normalized innovation squared of the latest update
+     */
+    void Add(double nis);
+
+    ///* 95% quantile of the chi-square distribution with n_z degrees of freedom
+    double Threshold() const { return threshold_; }
+
+    ///* fraction of samples in the window above Threshold()
+    double ExceedanceRate() const;
+
+    ///* mean NIS of the window, n_z for a consistent filter
+    double Mean() const;
+
+    ///* consistency verdict over the window
+    Status GetStatus() const;
+
+    ///* sample counts per bucket over the window
+    const std::vector<int>& Histogram() const { return histogram_; }
+
+    ///* width of one histogram bucket
+    double BucketWidth() const { return bucket_width_; }
+
+    ///* number of samples in the window
+    int Size() const { return size_; }
+
+    ///* number of samples since construction
+    long Total() const { return total_; }
+
+    ///* number of NaN or infinite samples since construction, left out of the statistics
+    long NonFinite() const { return non_finite_; }
+
+    static const char* StatusName(Status status);
+
+private:
+    int Bucket(double nis) const;
+
+    int n_z_;
+
+    double threshold_;
+
+    double bucket_width_;
+
+    // ring buffer of the latest samples
+    std::vector<double> samples_;
+    int head_;
+    int size_;
+    long total_;
+    long non_finite_;
+
+    // window statistics, updated incrementally
+    std::vector<int> histogram_;
+    int exceedances_;
+    double sum_;
+};
+
+#endif /* NIS_MONITOR_H_ */
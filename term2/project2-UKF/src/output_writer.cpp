@@ -0,0 +1,255 @@
+#include "output_writer.h"
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+
+const size_t OutputWriter::kNameSize;
+
+namespace {
+
+// longest formatted value plus the separator
+const size_t kMaxValueSize = 40;
+
+const char kMagic[8] = {'U', 'K', 'F', 'C', 'O', 'L', '2', '\0'};
+
+// offset of the number of rows in the BINARY header
+const long kRowsOffset = sizeof(kMagic) + 2 * sizeof(uint32_t);
+
+///* stores the low size bytes of value at out, least significant first
+void PutLittleEndian(uint64_t value, size_t size, unsigned char *out) {
+    for (size_t i = 0; i < size; i++) {
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+bool HostIsLittleEndian() {
+    const uint16_t one = 1;
+    unsigned char first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+///* rewrites n doubles in little endian byte order, in place
+void ToLittleEndian(double *values, size_t n) {
+    if (HostIsLittleEndian()) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uint64_t bits;
+        memcpy(&bits, &values[i], sizeof(bits));
+        PutLittleEndian(bits, sizeof(bits), reinterpret_cast<unsigned char*>(&values[i]));
+    }
+}
+
+#if !defined(__cpp_lib_to_chars)
+/**
+ * Shortest round trip without std::to_chars: the fewest significant digits,
+ * from the guaranteed precision up to max_digits, that parse back to value
+ */
+template <typename T>
+char* FormatShortest(T value, char *out, int min_digits, int max_digits) {
+    int n = 0;
+    for (int digits = min_digits; digits <= max_digits; digits++) {
+        n = snprintf(out, kMaxValueSize, "%.*g", digits, static_cast<double>(value));
+        if (static_cast<T>(strtod(out, NULL)) == value) {
+            break;
+        }
+    }
+    return out + n;
+}
+#endif
+
+}  // namespace
+
+OutputWriter::OutputWriter(const std::vector<std::string> &columns, Format format, size_t buffer_size)
+    : columns_(columns),
+      format_(format),
+      file_(NULL),
+      ok_(true),
+      buffer_(format == BINARY ? 0 : buffer_size < 4 * kMaxValueSize ? 4 * kMaxValueSize : buffer_size),
+      used_(0),
+      data_(format == BINARY ? columns.size() : 0),
+      column_(0),
+      block_rows_(1),
+      rows_(0) {
+    if (!columns.empty() && buffer_size / (sizeof(double) * columns.size()) > 1) {
+        block_rows_ = buffer_size / (sizeof(double) * columns.size());
+    }
+}
+
+OutputWriter::~OutputWriter() {
+    Close();
+}
+
+OutputWriter::Format OutputWriter::FormatFor(const std::string &file_name) {
+    const std::string ext = ".bin";
+    if (file_name.size() >= ext.size() &&
+        file_name.compare(file_name.size() - ext.size(), ext.size(), ext) == 0) {
+        return BINARY;
+    }
+    return TEXT;
+}
+
+bool OutputWriter::Open(const std::string &file_name) {
+    Close();
+    file_ = fopen(file_name.c_str(), format_ == BINARY ? "wb" : "w");
+    if (file_ == NULL) {
+        return false;
+    }
+    ok_ = true;
+    used_ = 0;
+    column_ = 0;
+    rows_ = 0;
+
+    if (format_ == TEXT) {
+        for (size_t i = 0; i < columns_.size(); i++) {
+            const std::string &name = columns_[i];
+            Reserve(name.size() + 1);
+            memcpy(&buffer_[used_], name.data(), name.size());
+            used_ += name.size();
+            buffer_[used_++] = i + 1 < columns_.size() ? '\t' : '\n';
+        }
+    }
+    else {
+        // columns, rows per block and the row count that Close fills in
+        unsigned char header[2 * sizeof(uint32_t) + sizeof(uint64_t)];
+        PutLittleEndian(static_cast<uint32_t>(columns_.size()), sizeof(uint32_t), header);
+        PutLittleEndian(static_cast<uint32_t>(block_rows_), sizeof(uint32_t), header + sizeof(uint32_t));
+        PutLittleEndian(rows_, sizeof(uint64_t), header + 2 * sizeof(uint32_t));
+        ok_ = ok_ && fwrite(kMagic, sizeof(kMagic), 1, file_) == 1;
+        ok_ = ok_ && fwrite(header, sizeof(header), 1, file_) == 1;
+        for (size_t i = 0; i < columns_.size(); i++) {
+            char name[kNameSize] = {0};
+            strncpy(name, columns_[i].c_str(), kNameSize - 1);
+            ok_ = ok_ && fwrite(name, kNameSize, 1, file_) == 1;
+        }
+        for (size_t i = 0; i < data_.size(); i++) {
+            data_[i].clear();
+            data_[i].reserve(block_rows_);
+        }
+    }
+    return true;
+}
+
+bool OutputWriter::Close() {
+    if (file_ == NULL) {
+        return ok_;
+    }
+
+    if (format_ == BINARY) {
+        FlushBlock();
+        unsigned char rows[sizeof(uint64_t)];
+        PutLittleEndian(rows_, sizeof(rows), rows);
+        ok_ = ok_ && fseek(file_, kRowsOffset, SEEK_SET) == 0;
+        ok_ = ok_ && fwrite(rows, sizeof(rows), 1, file_) == 1;
+    }
+    else {
+        Flush();
+    }
+
+    ok_ = fclose(file_) == 0 && ok_;
+    file_ = NULL;
+    return ok_;
+}
+
+void OutputWriter::Add(double value) {
+    if (format_ == BINARY) {
+        AddBinary(value);
+        return;
+    }
+    Reserve(kMaxValueSize);
+    char *end = FormatDouble(value, &buffer_[used_]);
+    *end++ = '\t';
+    used_ = end - &buffer_[0];
+}
+
+void OutputWriter::Add(float value) {
+    if (format_ == BINARY) {
+        AddBinary(value);
+        return;
+    }
+    Reserve(kMaxValueSize);
+    char *end = FormatFloat(value, &buffer_[used_]);
+    *end++ = '\t';
+    used_ = end - &buffer_[0];
+}
+
+void OutputWriter::AddMissing() {
+    if (format_ == BINARY) {
+        AddBinary(std::numeric_limits<double>::quiet_NaN());
+        return;
+    }
+    Reserve(4);
+    memcpy(&buffer_[used_], "N/A\t", 4);
+    used_ += 4;
+}
+
+void OutputWriter::EndRow() {
+    if (format_ == BINARY) {
+        // a short row would shift the following rows of its block
+        if (column_ != data_.size()) {
+            ok_ = false;
+        }
+        column_ = 0;
+        rows_++;
+        if (!data_.empty() && data_[0].size() >= block_rows_) {
+            FlushBlock();
+        }
+        return;
+    }
+    // the last separator ends the line
+    buffer_[used_ - 1] = '\n';
+}
+
+char* OutputWriter::FormatDouble(double value, char *out) {
+#if defined(__cpp_lib_to_chars)
+    return std::to_chars(out, out + kMaxValueSize, value).ptr;
+#else
+    return FormatShortest(value, out, std::numeric_limits<double>::digits10, 17);
+#endif
+}
+
+char* OutputWriter::FormatFloat(float value, char *out) {
+#if defined(__cpp_lib_to_chars)
+    return std::to_chars(out, out + kMaxValueSize, value).ptr;
+#else
+    return FormatShortest(value, out, std::numeric_limits<float>::digits10, 9);
+#endif
+}
+
+void OutputWriter::Reserve(size_t n) {
+    if (used_ + n > buffer_.size()) {
+        Flush();
+    }
+}
+
+void OutputWriter::Flush() {
+    if (used_ > 0 && file_ != NULL) {
+        ok_ = ok_ && fwrite(&buffer_[0], 1, used_, file_) == used_;
+    }
+    used_ = 0;
+}
+
+void OutputWriter::AddBinary(double value) {
+    if (column_ >= data_.size()) {
+        ok_ = false;
+        return;
+    }
+    data_[column_++].push_back(value);
+}
+
+void OutputWriter::FlushBlock() {
+    for (size_t i = 0; i < data_.size(); i++) {
+        const size_t n = data_[i].size();
+        if (n > 0 && file_ != NULL) {
+            ToLittleEndian(data_[i].data(), n);
+            ok_ = ok_ && fwrite(data_[i].data(), sizeof(double), n, file_) == n;
+        }
+        data_[i].clear();
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef OUTPUT_WRITER_H_
+#define OUTPUT_WRITER_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * Buffered row writer for the filter output.
+ *
+ * TEXT writes tab separated values with a header line, doubles in the
+ * shortest form that reads back to the same value. BINARY stores blocks of
+ * rows, every column of a block a contiguous little endian float64 array:
+ *
+ *   char[8]   magic "UKFCOL2"
+ *   uint32    number of columns
+ *   uint32    rows per block
+ *   uint64    number of rows, written on Close
+ *   char[32]  name of every column, zero padded
+ *   float64   block rows of column 0, then of column 1, ... for every
+ *             block, the last block holds the remaining rows
+ *
+ * Both formats are written whenever the buffer is full, so memory does not
+ * grow with the number of rows. Missing values are "N/A" in TEXT and NaN in
+ * BINARY. A BINARY row with more or fewer values than columns fails Close.
+ */
+class OutputWriter {
+public:
+    enum Format {
+        TEXT,
+        BINARY
+    };
+
+    ///* length of the zero padded column names of BINARY
+    static const size_t kNameSize = 32;
+
+    /**
+     * Constructor
+     * @param columns Column names, every row has one value per column
+     * @param format Output format
+     * @param buffer_size Bytes buffered before they are written to the file,
+     * BINARY rounds it down to whole rows
+     */
+    OutputWriter(const std::vector<std::string> &columns, Format format, size_t buffer_size = 1 << 20);
+
+    /**
+     * Destructor, closes the file
+     */
+    virtual ~OutputWriter();
+
+    /**
+     * Open Creates the file and writes the header; BINARY needs a seekable
+     * file to fill in the number of rows on Close
+     */
+    bool Open(const std::string &file_name);
+
+    /**
+     * Close Writes the remaining buffer, BINARY then the number of rows
+     * @return false if any write failed
+     */
+    bool Close();
+
+    ///* appends the next value of the current row
+    void Add(double value);
+
+    ///* appends the next value of the current row, TEXT keeps float precision
+    void Add(float value);
+
+    ///* appends a missing value to the current row
+    void AddMissing();
+
+    ///* finishes the current row
+    void EndRow();
+
+    ///* BINARY for file names ending in ".bin", TEXT otherwise
+    static Format FormatFor(const std::string &file_name);
+
+    /**
+     * FormatDouble Writes the shortest decimal form of value that reads back
+     * to the same double, without a terminating zero
+     * @param out Buffer of at least 32 chars
+     * @return end of the written chars
+     */
+    static char* FormatDouble(double value, char *out);
+
+    ///* FormatDouble for floats
+    static char* FormatFloat(float value, char *out);
+
+private:
+    // text output, makes room for at least n more chars
+    void Reserve(size_t n);
+    void Flush();
+
+    // binary output, appends to the current column; a value beyond the last
+    // column is dropped and fails Close
+    void AddBinary(double value);
+
+    // binary output, writes the buffered rows as one block
+    void FlushBlock();
+
+    std::vector<std::string> columns_;
+    Format format_;
+    FILE *file_;
+    bool ok_;
+
+    // text buffer
+    std::vector<char> buffer_;
+    size_t used_;
+
+    // binary columns of the current block
+    std::vector<std::vector<double> > data_;
+    size_t column_;
+    size_t block_rows_;
+    unsigned long long rows_;
+};
+
+#endif /* OUTPUT_WRITER_H_ */
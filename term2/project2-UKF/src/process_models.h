@@ -0,0 +1,226 @@
+#ifndef PROCESS_MODELS_H_
+#define PROCESS_MODELS_H_
+
+#include <cmath>
+#include "Eigen/Dense"
+
+/**
+ * Process models for UnscentedFilter.
+ *
+ * A process model declares the state dimension kStateDim, the process noise
+ * dimension kNoiseDim and the bit mask kAngles of the state components that
+ * are angles. operator() maps one augmented sigma point [state, noise] to
+ * the predicted state after delta_t seconds.
+ *
+ * The models of the state [px py v yaw yawd ...] also take the sines and
+ * cosines of the heading as a HeadingTrig, so several models predicting
+ * the same sigma point evaluate them once.
+ */
+
+/**
+ * sin and cos of the heading of a sigma point, before (yaw) and after
+ * (yaw + yawd * delta_t) a step
+ */
+struct HeadingTrig {
+    double sin_yaw, cos_yaw;
+    double sin_yaw_p, cos_yaw_p;
+
+    HeadingTrig(double yaw, double yawd, double delta_t)
+        : sin_yaw(sin(yaw)), cos_yaw(cos(yaw)),
+          sin_yaw_p(sin(yaw + yawd*delta_t)), cos_yaw_p(cos(yaw + yawd*delta_t)) {}
+
+    ///* the heading before the step only, for models that do not turn
+    explicit HeadingTrig(double yaw)
+        : sin_yaw(sin(yaw)), cos_yaw(cos(yaw)), sin_yaw_p(sin_yaw), cos_yaw_p(cos_yaw) {}
+};
+
+/**
+ * Constant turn rate and velocity magnitude model (CTRV)
+ * state: [px py v yaw yawd], noise: [nu_a nu_yawdd]
+ */
+struct CtrvModel {
+    enum {
+        kStateDim = 5,
+        kNoiseDim = 2,
+        kAngles = 1 << 3
+    };
+
+    typedef Eigen::Matrix<double, kStateDim, 1> StateVector;
+
+    template <typename Derived>
+    StateVector operator()(const Eigen::MatrixBase<Derived> &x_aug, double delta_t) const {
+        return (*this)(x_aug, delta_t, HeadingTrig(x_aug(3), x_aug(4), delta_t));
+    }
+
+    template <typename Derived>
+    StateVector operator()(const Eigen::MatrixBase<Derived> &x_aug, double delta_t, const HeadingTrig &trig) const {
+        //extract values for better readability
+        double p_x = x_aug(0);
+        double p_y = x_aug(1);
+        double v = x_aug(2);
+        double yaw = x_aug(3);
+        double yawd = x_aug(4);
+        double nu_a = x_aug(5);
+        double nu_yawdd = x_aug(6);
+
+        //predicted state values
+        double px_p, py_p;
+
+        //avoid division by zero
+        if (fabs(yawd) > 0.001) {
+            px_p = p_x + v/yawd * ( trig.sin_yaw_p - trig.sin_yaw);
+            py_p = p_y + v/yawd * ( trig.cos_yaw - trig.cos_yaw_p );
+        }
+        else {
+            px_p = p_x + v*delta_t*trig.cos_yaw;
+            py_p = p_y + v*delta_t*trig.sin_yaw;
+        }
+
+        double v_p = v;
+        double yaw_p = yaw + yawd*delta_t;
+        double yawd_p = yawd;
+
+        //add noise
+        px_p = px_p + 0.5*nu_a*delta_t*delta_t * trig.cos_yaw;
+        py_p = py_p + 0.5*nu_a*delta_t*delta_t * trig.sin_yaw;
+        v_p = v_p + nu_a*delta_t;
+
+        yaw_p = yaw_p + 0.5*nu_yawdd*delta_t*delta_t;
+        yawd_p = yawd_p + nu_yawdd*delta_t;
+
+        StateVector x_pred;
+        x_pred << px_p, py_p, v_p, yaw_p, yawd_p;
+        return x_pred;
+    }
+};
+
+/**
+ * Constant velocity model (CV)
+ * state: [px py v yaw yawd], noise: [nu_a nu_yawdd]
+ * The turn rate does not move the object, it only follows the noise.
+ */
+struct CvModel {
+    enum {
+        kStateDim = 5,
+        kNoiseDim = 2,
+        kAngles = 1 << 3
+    };
+
+    typedef Eigen::Matrix<double, kStateDim, 1> StateVector;
+
+    template <typename Derived>
+    StateVector operator()(const Eigen::MatrixBase<Derived> &x_aug, double delta_t) const {
+        return (*this)(x_aug, delta_t, HeadingTrig(x_aug(3)));
+    }
+
+    ///* reads the heading before the step only
+    template <typename Derived>
+    StateVector operator()(const Eigen::MatrixBase<Derived> &x_aug, double delta_t, const HeadingTrig &trig) const {
+        double p_x = x_aug(0);
+        double p_y = x_aug(1);
+        double v = x_aug(2);
+        double yaw = x_aug(3);
+        double yawd = x_aug(4);
+        double nu_a = x_aug(5);
+        double nu_yawdd = x_aug(6);
+
+        double dist = v*delta_t + 0.5*nu_a*delta_t*delta_t;
+
+        StateVector x_pred;
+        x_pred << p_x + dist*trig.cos_yaw,
+                  p_y + dist*trig.sin_yaw,
+                  v + nu_a*delta_t,
+                  yaw + 0.5*nu_yawdd*delta_t*delta_t,
+                  yawd + nu_yawdd*delta_t;
+        return x_pred;
+    }
+};
+
+/**
+ * Constant turn rate and acceleration model (CTRA)
+ * state: [px py v yaw yawd a], noise: [nu_j nu_yawdd] (longitudinal jerk, yaw acceleration)
+ */
+struct CtraModel {
+    enum {
+        kStateDim = 6,
+        kNoiseDim = 2,
+        kAngles = 1 << 3
+    };
+
+    typedef Eigen::Matrix<double, kStateDim, 1> StateVector;
+
+    template <typename Derived>
+    StateVector operator()(const Eigen::MatrixBase<Derived> &x_aug, double delta_t) const {
+        return (*this)(x_aug, delta_t, HeadingTrig(x_aug(3), x_aug(4), delta_t));
+    }
+
+    template <typename Derived>
+    StateVector operator()(const Eigen::MatrixBase<Derived> &x_aug, double delta_t, const HeadingTrig &trig) const {
+        double p_x = x_aug(0);
+        double p_y = x_aug(1);
+        double v = x_aug(2);
+        double yaw = x_aug(3);
+        double yawd = x_aug(4);
+        double a = x_aug(5);
+        double nu_j = x_aug(6);
+        double nu_yawdd = x_aug(7);
+
+        double v_p = v + a*delta_t;
+        double yaw_p = yaw + yawd*delta_t;
+
+        double px_p, py_p;
+
+        //avoid division by zero
+        if (fabs(yawd) > 0.001) {
+            double yawd2 = yawd*yawd;
+            px_p = p_x + (v_p*yawd*trig.sin_yaw_p + a*trig.cos_yaw_p - v*yawd*trig.sin_yaw - a*trig.cos_yaw) / yawd2;
+            py_p = p_y + (-v_p*yawd*trig.cos_yaw_p + a*trig.sin_yaw_p + v*yawd*trig.cos_yaw - a*trig.sin_yaw) / yawd2;
+        }
+        else {
+            double dist = v*delta_t + 0.5*a*delta_t*delta_t;
+            px_p = p_x + dist*trig.cos_yaw;
+            py_p = p_y + dist*trig.sin_yaw;
+        }
+
+        //add noise
+        double dt2 = delta_t*delta_t;
+        StateVector x_pred;
+        x_pred << px_p + nu_j*dt2*delta_t/6.0 * trig.cos_yaw,
+                  py_p + nu_j*dt2*delta_t/6.0 * trig.sin_yaw,
+                  v_p + 0.5*nu_j*dt2,
+                  yaw_p + 0.5*nu_yawdd*dt2,
+                  yawd + nu_yawdd*delta_t,
+                  a + nu_j*delta_t;
+        return x_pred;
+    }
+};
+
+/**
+ * Runs Model on the leading components of a state with kExtraDim more
+ * components, which are kept constant. Used to give the bank models one
+ * common state, e.g. CTRV on the CTRA state.
+ */
+template <class Model, int kExtraDim>
+struct PaddedModel {
+    enum {
+        kStateDim = Model::kStateDim + kExtraDim,
+        kNoiseDim = Model::kNoiseDim,
+        kAngles = Model::kAngles
+    };
+
+    typedef Eigen::Matrix<double, kStateDim, 1> StateVector;
+
+    Model model_;
+
+    template <typename Derived, typename... Trig>
+    StateVector operator()(const Eigen::MatrixBase<Derived> &x_aug, double delta_t, const Trig&... trig) const {
+        Eigen::Matrix<double, Model::kStateDim + Model::kNoiseDim, 1> x_inner;
+        x_inner << x_aug.template head<int(Model::kStateDim)>(), x_aug.template tail<int(kNoiseDim)>();
+
+        StateVector x_pred;
+        x_pred << model_(x_inner, delta_t, trig...), x_aug.template segment<kExtraDim>(Model::kStateDim);
+        return x_pred;
+    }
+};
+
+#endif /* PROCESS_MODELS_H_ */
@@ -0,0 +1,44 @@
+#include "sigma_points.h"
+#include <cmath>
+
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+SigmaPoints::SigmaPoints(Type type, int n, double param) : type_(type) {
+    if (type_ == SYMMETRIC) {
+        // 2n+1 points: the mean and +/- sqrt(lambda + n) along every axis
+        double lambda = param;
+        double spread = sqrt(lambda + n);
+
+        weights_ = VectorXd::Constant(2 * n + 1, 0.5 / (lambda + n));
+        weights_(0) = lambda / (lambda + n);
+
+        U_ = MatrixXd::Zero(n, 2 * n + 1);
+        for (int i = 0; i < n; i++) {
+            U_(i, i + 1)     =  spread;
+            U_(i, i + 1 + n) = -spread;
+        }
+    }
+    else {
+        // n+2 points: the mean plus a simplex grown one dimension at a time,
+        // see Julier, "The spherical simplex unscented transformation" (2003)
+        double w0 = param;
+        double w1 = (1.0 - w0) / (n + 1);
+
+        weights_ = VectorXd::Constant(n + 2, w1);
+        weights_(0) = w0;
+
+        U_ = MatrixXd::Zero(n, n + 2);
+        U_(0, 1) = -1.0 / sqrt(2.0 * w1);
+        U_(0, 2) =  1.0 / sqrt(2.0 * w1);
+        for (int j = 2; j <= n; j++) {
+            double scale = 1.0 / sqrt(j * (j + 1) * w1);
+            for (int i = 1; i <= j; i++) {
+                U_(j - 1, i) = -scale;
+            }
+            U_(j - 1, j + 1) = j * scale;
+        }
+    }
+}
+
+SigmaPoints::~SigmaPoints() {}
@@ -0,0 +1,54 @@
+#ifndef SIGMA_POINTS_H_
+#define SIGMA_POINTS_H_
+
+#include "Eigen/Dense"
+
+/**
+ * Sigma point set of the unscented transform.
+ *
+ * The points are stored once in whitened coordinates (unit points U), so the
+ * set for mean x and covariance P = L * L^T is X = x * 1^T + L * U. Weights
+ * are computed once in the constructor.
+ */
+class SigmaPoints {
+public:
+    enum Type {
+        ///* 2n+1 points, symmetric around the mean (spreading parameter lambda)
+        SYMMETRIC,
+        ///* n+2 points on a hypersphere (Julier's spherical simplex, center weight W0)
+        SPHERICAL_SIMPLEX
+    };
+
+    /**
+     * Constructor
+     * @param type Sigma point strategy
+     * @param n Dimension of the (augmented) state
+     * @param param lambda for SYMMETRIC, center weight W0 in [0, 1) for SPHERICAL_SIMPLEX
+     */
+    SigmaPoints(Type type, int n, double param);
+
+    /**
+     * Destructor
+     */
+    virtual ~SigmaPoints();
+
+    Type type() const { return type_; }
+
+    ///* number of sigma points
+    int Size() const { return static_cast<int>(weights_.size()); }
+
+    ///* weights of the sigma points, used for mean and covariance
+    const Eigen::VectorXd& Weights() const { return weights_; }
+
+    ///* sigma points in whitened coordinates, n x Size()
+    const Eigen::MatrixXd& UnitPoints() const { return U_; }
+
+private:
+    Type type_;
+
+    Eigen::VectorXd weights_;
+
+    Eigen::MatrixXd U_;
+};
+
+#endif /* SIGMA_POINTS_H_ */
@@ -1,9 +1,12 @@
 #include <iostream>
+#include <sstream>
+#include <string>
 #include "tools.h"
 
 using Eigen::VectorXd;
 using Eigen::MatrixXd;
 using std::vector;
+using std::string;
 
 Tools::Tools() {}
 
@@ -33,3 +36,63 @@ VectorXd Tools::CalculateRMSE(const vector<VectorXd> &estimations, const vector<
     //return the result
     return rmse;
 }
+
+void Tools::ReadMeasurements(std::istream &in, bool use_laser, bool use_radar,
+                             vector<MeasurementPackage> *measurements,
+                             vector<GroundTruthPackage> *ground_truth) {
+    string line;
+    // prep the measurement packages (each line represents a measurement at timestamp)
+    while (getline(in, line)) {
+        string sensor_type;
+        MeasurementPackage meas_package;
+        GroundTruthPackage gt_package;
+        std::istringstream iss(line);
+        long long timestamp;
+
+        // reads first element from the current line
+        iss >> sensor_type;
+
+        if (sensor_type.compare("L") == 0) {
+            if (!use_laser) {
+                continue;
+            }
+            // laser measurement
+            // read measurements at this timestamp
+            meas_package.sensor_type_ = MeasurementPackage::LASER;
+            meas_package.raw_measurements_ = VectorXd(2);
+            float px, py;
+            iss >> px;
+            iss >> py;
+            meas_package.raw_measurements_ << px, py;
+            iss >> timestamp;
+            meas_package.timestamp_ = timestamp;
+            measurements->push_back(meas_package);
+        } else if (sensor_type.compare("R") == 0) {
+            if (!use_radar) {
+                continue;
+            }
+            // radar measurement
+            // read measurements at this timestamp
+            meas_package.sensor_type_ = MeasurementPackage::RADAR;
+            meas_package.raw_measurements_ = VectorXd(3);
+            float ro, phi, ro_dot;
+            iss >> ro;
+            iss >> phi;
+            iss >> ro_dot;
+            meas_package.raw_measurements_ << ro, phi, ro_dot;
+            iss >> timestamp;
+            meas_package.timestamp_ = timestamp;
+            measurements->push_back(meas_package);
+        }
+
+        // read ground truth data to compare later
+        float x_gt, y_gt, vx_gt, vy_gt;
+        iss >> x_gt;
+        iss >> y_gt;
+        iss >> vx_gt;
+        iss >> vy_gt;
+        gt_package.gt_values_ = VectorXd(4);
+        gt_package.gt_values_ << x_gt, y_gt, vx_gt, vy_gt;
+        ground_truth->push_back(gt_package);
+    }
+}
@@ -1,7 +1,10 @@
 #ifndef TOOLS_H_
 #define TOOLS_H_
+#include <istream>
 #include <vector>
 #include "Eigen/Dense"
+#include "measurement_package.h"
+#include "ground_truth_package.h"
 
 class Tools {
 public:
@@ -19,6 +22,14 @@ public:
     * A helper method to calculate RMSE.
     */
     Eigen::VectorXd CalculateRMSE(const std::vector<Eigen::VectorXd> &estimations, const std::vector<Eigen::VectorXd> &ground_truth);
+
+    /**
+    * A helper method to read the measurements and the ground truth of an input file.
+    * Lines of a disabled sensor are skipped.
+    */
+    void ReadMeasurements(std::istream &in, bool use_laser, bool use_radar,
+                          std::vector<MeasurementPackage> *measurements,
+                          std::vector<GroundTruthPackage> *ground_truth);
 };
 
 #endif /* TOOLS_H_ */
@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Eigen/Dense"
+#include "ukf.h"
+#include "tools.h"
+
+using namespace std;
+using Eigen::VectorXd;
+
+/**
+ * Searches the process noise (std_a, std_yawdd) of the UKF on recorded logs
+ * and writes the best pair to a config file for UnscentedKF.
+ *
+ * Objective: sum of the RMSE of px, py, vx, vy, scaled up by how far the mean
+ * NIS of each sensor is from its degrees of freedom, |log(mean NIS / n_z)|.
+ * The RMSE alone favours overconfident filters; the NIS term keeps the
+ * covariance honest. Candidates are evaluated concurrently on a thread pool,
+ * all workers read the same parsed copy of the logs.
+ */
+
+namespace {
+
+struct Dataset {
+    string name;
+    vector<MeasurementPackage> measurements;
+    vector<GroundTruthPackage> ground_truth;
+};
+
+struct Candidate {
+    double std_a;
+    double std_yawdd;
+    double rmse;
+    double nis_laser;
+    double nis_radar;
+    double exceed_laser;
+    double exceed_radar;
+    double cost;
+};
+
+/**
+ * Fixed set of worker threads running indexed tasks; Run blocks until all
+ * tasks are done and every worker is back waiting, so the next Run cannot
+ * change the task while a late worker still reads it. Workers take the next
+ * index from a shared counter.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(int n_threads) : n_tasks_(0), next_(0), busy_(0), generation_(0), stop_(false) {
+        for (int i = 0; i < n_threads; i++) {
+            workers_.push_back(thread(&ThreadPool::Work, this));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_.notify_all();
+        for (size_t i = 0; i < workers_.size(); i++) {
+            workers_[i].join();
+        }
+    }
+
+    void Run(size_t n_tasks, const function<void(size_t)> &task) {
+        unique_lock<mutex> lock(mutex_);
+        task_ = task;
+        n_tasks_ = n_tasks;
+        next_ = 0;
+        busy_ = workers_.size();
+        generation_++;
+        start_.notify_all();
+        done_.wait(lock, [this] { return busy_ == 0; });
+    }
+
+    int Size() const { return static_cast<int>(workers_.size()); }
+
+private:
+    void Work() {
+        unsigned long seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(mutex_);
+                start_.wait(lock, [&] { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+            }
+
+            for (size_t i = next_++; i < n_tasks_; i = next_++) {
+                task_(i);
+            }
+
+            lock_guard<mutex> lock(mutex_);
+            if (--busy_ == 0) done_.notify_all();
+        }
+    }
+
+    vector<thread> workers_;
+    function<void(size_t)> task_;
+    size_t n_tasks_;
+    atomic<size_t> next_;
+    // workers that have not finished the current generation
+    size_t busy_;
+    unsigned long generation_;
+    bool stop_;
+    mutex mutex_;
+    condition_variable start_;
+    condition_variable done_;
+};
+
+/**
+ * Runs the UKF with the sigma point set and the noise of the candidate over
+ * all logs and fills in its statistics and cost
+ */
+void Evaluate(const vector<Dataset> &datasets, SigmaPoints::Type sigma_type, double nis_weight, Candidate *c) {
+    Tools tools;
+    double rmse = 0;
+    double nis_sum[2] = {0, 0};
+    double exceed[2] = {0, 0};
+    long count[2] = {0, 0};
+
+    for (size_t d = 0; d < datasets.size(); d++) {
+        const Dataset &data = datasets[d];
+        UKF ukf(sigma_type);
+        ukf.std_a_ = c->std_a;
+        ukf.std_yawdd_ = c->std_yawdd;
+        ukf.SetNoise();
+
+        vector<VectorXd> estimations;
+        vector<VectorXd> ground_truth;
+        estimations.reserve(data.measurements.size());
+        ground_truth.reserve(data.measurements.size());
+
+        for (size_t k = 0; k < data.measurements.size(); k++) {
+            const MeasurementPackage &meas = data.measurements[k];
+            bool initialized = ukf.is_initialized_;
+            ukf.ProcessMeasurement(meas);
+
+            if (initialized) {
+                int s = meas.sensor_type_ == MeasurementPackage::LASER ? 0 : 1;
+                double nis = s == 0 ? ukf.NIS_laser_ : ukf.NIS_radar_;
+                double threshold = s == 0 ? ukf.nis_laser_monitor_.Threshold()
+                                          : ukf.nis_radar_monitor_.Threshold();
+                nis_sum[s] += nis;
+                exceed[s] += nis > threshold;
+                count[s]++;
+            }
+
+            VectorXd estimate(4);
+            estimate << ukf.x_(0), ukf.x_(1), ukf.x_(2) * cos(ukf.x_(3)), ukf.x_(2) * sin(ukf.x_(3));
+            estimations.push_back(estimate);
+            ground_truth.push_back(data.ground_truth[k].gt_values_);
+        }
+
+        rmse += tools.CalculateRMSE(estimations, ground_truth).sum();
+    }
+
+    const int n_z[2] = {LidarModel::kDim, RadarModel::kDim};
+    double penalty = 0;
+    double mean[2];
+    for (int s = 0; s < 2; s++) {
+        mean[s] = count[s] > 0 ? nis_sum[s] / count[s] : n_z[s];
+        exceed[s] = count[s] > 0 ? exceed[s] / count[s] : 0.05;
+        penalty += fabs(log(mean[s] / n_z[s]));
+    }
+
+    c->rmse = rmse / datasets.size();
+    c->nis_laser = mean[0];
+    c->nis_radar = mean[1];
+    c->exceed_laser = exceed[0];
+    c->exceed_radar = exceed[1];
+    c->cost = c->rmse * (1.0 + nis_weight * penalty);
+    // diverged runs produce NaN
+    if (!(c->cost == c->cost)) {
+        c->cost = numeric_limits<double>::infinity();
+    }
+}
+
+/**
+ * Log spaced grid of n x n candidates around (std_a, std_yawdd), from
+ * center / spread to center * spread in both dimensions
+ */
+vector<Candidate> Grid(double std_a, double std_yawdd, double spread, int n) {
+    vector<Candidate> candidates;
+    for (int i = 0; i < n; i++) {
+        double fa = pow(spread, 2.0 * i / (n - 1) - 1.0);
+        for (int j = 0; j < n; j++) {
+            double fy = pow(spread, 2.0 * j / (n - 1) - 1.0);
+            Candidate c = Candidate();
+            c.std_a = std_a * fa;
+            c.std_yawdd = std_yawdd * fy;
+            candidates.push_back(c);
+        }
+    }
+    return candidates;
+}
+
+bool ByCost(const Candidate &a, const Candidate &b) {
+    return a.cost < b.cost;
+}
+
+void PrintCandidate(const char *label, const Candidate &c) {
+    cout << label << " std_a " << c.std_a << ", std_yawdd " << c.std_yawdd
+         << " - cost " << c.cost << ", RMSE sum " << c.rmse
+         << ", mean NIS laser " << c.nis_laser << " (" << c.exceed_laser * 100 << "% above 95%)"
+         << ", radar " << c.nis_radar << " (" << c.exceed_radar * 100 << "% above 95%)" << endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    string usage_instructions = "Usage instructions: ";
+    usage_instructions += argv[0];
+    usage_instructions += " [-j threads] [-w nis_weight] [--simplex] output.cfg path/to/input.txt [more inputs...]";
+
+    int n_threads = static_cast<int>(thread::hardware_concurrency());
+    double nis_weight = 0.25;
+    SigmaPoints::Type sigma_type = SigmaPoints::SYMMETRIC;
+    int arg = 1;
+    while (arg + 1 < argc && argv[arg][0] == '-') {
+        string flag = argv[arg];
+        // the noise is tuned for the sigma point set UnscentedKF runs with
+        if (flag == "--simplex") {
+            sigma_type = SigmaPoints::SPHERICAL_SIMPLEX;
+            arg++;
+            continue;
+        }
+        if (flag == "-j") {
+            n_threads = atoi(argv[arg + 1]);
+        } else if (flag == "-w") {
+            nis_weight = atof(argv[arg + 1]);
+        } else {
+            cerr << "Unknown option " << flag << ".\n" << usage_instructions << endl;
+            exit(EXIT_FAILURE);
+        }
+        arg += 2;
+    }
+    if (argc - arg < 2) {
+        cerr << usage_instructions << endl;
+        exit(EXIT_FAILURE);
+    }
+    n_threads = max(1, n_threads);
+
+    string config_name = argv[arg++];
+
+    // parse every log once, the workers share the read-only copy
+    UKF defaults;
+    vector<Dataset> datasets;
+    Tools tools;
+    for (; arg < argc; arg++) {
+        Dataset data;
+        data.name = argv[arg];
+        ifstream in_file(data.name.c_str(), ifstream::in);
+        if (!in_file.is_open()) {
+            cerr << "Cannot open input file: " << data.name << endl;
+            exit(EXIT_FAILURE);
+        }
+        tools.ReadMeasurements(in_file, defaults.use_laser_, defaults.use_radar_,
+                               &data.measurements, &data.ground_truth);
+        datasets.push_back(data);
+    }
+
+    ThreadPool pool(n_threads);
+    cout << "Tuning on " << datasets.size() << " log(s) with " << pool.Size() << " threads" << endl;
+
+    Candidate best = Candidate();
+    best.std_a = defaults.std_a_;
+    best.std_yawdd = defaults.std_yawdd_;
+    Evaluate(datasets, sigma_type, nis_weight, &best);
+    PrintCandidate("default", best);
+
+    // coarse log grid over two decades, then finer grids around the best candidate
+    double spread = 10.0;
+    int n = 13;
+    for (int round = 0; round < 4; round++) {
+        vector<Candidate> candidates = Grid(best.std_a, best.std_yawdd, spread, n);
+        pool.Run(candidates.size(), [&](size_t i) { Evaluate(datasets, sigma_type, nis_weight, &candidates[i]); });
+
+        const Candidate &round_best = *min_element(candidates.begin(), candidates.end(), ByCost);
+        if (round_best.cost < best.cost) {
+            best = round_best;
+        }
+
+        ostringstream label;
+        label << "round " << round + 1 << " (" << candidates.size() << " candidates)";
+        PrintCandidate(label.str().c_str(), best);
+
+        spread = sqrt(spread);
+        n = 7;
+    }
+
+    UKF tuned;
+    tuned.std_a_ = best.std_a;
+    tuned.std_yawdd_ = best.std_yawdd;
+    ostringstream comment;
+    comment << "TuneNoise: cost " << best.cost << ", RMSE sum " << best.rmse
+            << ", mean NIS laser " << best.nis_laser << ", radar " << best.nis_radar;
+    if (!tuned.SaveConfig(config_name, comment.str())) {
+        exit(EXIT_FAILURE);
+    }
+    cout << "Wrote " << config_name << endl;
+    return 0;
+}
@@ -1,15 +1,24 @@
 #include "ukf.h"
 #include <iostream>
+#include <limits>
+#include <sstream>
 
 using namespace std;
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
 using std::vector;
 
+const double UKF::kMinDeltaT = 1e-4;
+
 /**
  * Initializes Unscented Kalman filter
+ * The spreading parameter is 3 - n_x.
+ * The simplex set uses a zero center weight, larger values lose track on sample data 2.
  */
-UKF::UKF() {
+UKF::UKF(SigmaPoints::Type sigma_type)
+    : UnscentedFilter(SigmaPoints(sigma_type, kAugDim,
+                                  sigma_type == SigmaPoints::SYMMETRIC ? 3 - kStateDim : 0.0)),
+      nis_radar_monitor_(3), nis_laser_monitor_(2), bank_(NULL), sigma_type_(sigma_type) {
     // initially set to false, set to true in first call of ProcessMeasurement
     is_initialized_ = false;
 
@@ -19,27 +28,8 @@ UKF::UKF() {
     // if this is false, radar measurements will be ignored (except during init)
     use_radar_ = true;
 
-    // State dimension
-    n_x_ = 5;
-
-    // Augmented state dimension
-    n_aug_ = 7;
-
-    // Sigma point spreading parameter
-    lambda_ = 3 - n_x_;
-
-    // initial state vector
-    x_ = VectorXd(n_x_);
-
-    // initial covariance matrix
-    P_ =  MatrixXd::Identity(n_x_, n_x_);
-
-
-    // predicted sigma points matrix
-    Xsig_pred_ = MatrixXd(n_x_, 2 * n_aug_ + 1);;
-
-    // Weights of sigma points
-    weights_ = VectorXd(2 * n_aug_ + 1);
+    // the single CTRV filter unless the GPB1 bank is asked for
+    use_bank_ = false;
 
     // Process noise standard deviation longitudinal acceleration in m/s^2
     std_a_ = 3.0;
@@ -47,6 +37,9 @@ UKF::UKF() {
     // Process noise standard deviation yaw acceleration in rad/s^2
     std_yawdd_ = 0.5;
 
+    // Process noise standard deviation longitudinal jerk of the bank's CTRA model in m/s^3
+    std_j_ = 0.5;
+
     // Laser measurement noise standard deviation position1 in m
     std_laspx_ = 0.08;
 
@@ -62,20 +55,17 @@ UKF::UKF() {
     // Radar measurement noise standard deviation radius change in m/s
     std_radrd_ = 0.15;
 
-    //measurement noise covariance matrix
-    R_radar_ = MatrixXd(3, 3);
-    R_radar_ <<     std_radr_ * std_radr_, 0                         , 0,
-                    0                    , std_radphi_ * std_radphi_ , 0,
-                    0                    , 0                         , std_radrd_*std_radrd_;
-
-    R_laser_ = MatrixXd(2, 2);
-    R_laser_ <<     std_laspx_ * std_laspx_, 0 ,
-                    0                      , std_laspy_ * std_laspy_ ;
+    //process and measurement noise covariance matrices
+    SetNoise();
 
     NIS_radar_ = NIS_laser_ = 0;
+
+    out_of_order_ = 0;
 }
 
-UKF::~UKF() {}
+UKF::~UKF() {
+    delete bank_;
+}
 
 /**
  * @param {MeasurementPackage} meas_package The latest measurement data of
@@ -99,8 +89,6 @@ void UKF::ProcessMeasurement(MeasurementPackage meas_package) {
          */
 
         // First measurement
-        std::cout << "UKF: " << std::endl;
-
         if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
             // Convert radar from polar to cartesian coordinates and initialize state
             float ro = static_cast<float>(meas_package.raw_measurements_(0));
@@ -113,9 +101,14 @@ void UKF::ProcessMeasurement(MeasurementPackage meas_package) {
             x_ << meas_package.raw_measurements_[0], meas_package.raw_measurements_[1], 0, 0, 0;
         }
 
-        previous_timestamp_ = meas_package.timestamp_;
+        time_us_ = meas_package.timestamp_;
         // Done initializing, no need to predict or update
         is_initialized_ = true;
+
+        // the bank initializes from the same measurement
+        if (use_bank_) {
+            Bank().ProcessMeasurement(meas_package);
+        }
         return;
     }
 
@@ -125,16 +118,36 @@ void UKF::ProcessMeasurement(MeasurementPackage meas_package) {
      * Update the process noise covariance matrix.
      ****************************************************************************/
 
-    //compute the time elapsed between the current and previous measurements
-    float dt = static_cast<float>((meas_package.timestamp_ - previous_timestamp_) / 1000000.0);	//dt - expressed in seconds
-    previous_timestamp_ = meas_package.timestamp_;
+    //compute the time elapsed between the state and the current measurement
+    float dt = static_cast<float>((meas_package.timestamp_ - time_us_) / 1000000.0);	//dt - expressed in seconds
 
-    while (dt > 0.1) {
-        const double delta_t = 0.05;
-        Prediction(delta_t);
-        dt -= delta_t;
+    //a measurement older than the state cannot be fused against it, drop it
+    if (dt < 0) {
+        out_of_order_++;
+        cerr << "Dropped out of order measurement at " << meas_package.timestamp_
+             << " us, state is at " << time_us_ << " us" << endl;
+        return;
+    }
+
+    if (use_bank_) {
+        if (dt >= kMinDeltaT) {
+            time_us_ = meas_package.timestamp_;
+        }
+        ProcessBank(meas_package);
+        return;
+    }
+
+    //measurements at the same time reuse the predicted state and sigma points
+    if (dt >= kMinDeltaT) {
+        time_us_ = meas_package.timestamp_;
+
+        while (dt > 0.1) {
+            const double delta_t = 0.05;
+            Prediction(delta_t);
+            dt -= delta_t;
+        }
+        Prediction(dt);
     }
-    Prediction(dt);
 
     /*****************************************************************************
      * Update
@@ -143,58 +156,11 @@ void UKF::ProcessMeasurement(MeasurementPackage meas_package) {
      ****************************************************************************/
 
     if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
-        //set measurement dimension, radar can measure r, phi, and r_dot
-        n_z_ = 3;
+        UpdateRadar(meas_package);
     }
     else if (meas_package.sensor_type_ == MeasurementPackage::LASER) {
-        //set measurement dimension, laser can measure px, py
-        n_z_ = 2;
+        UpdateLidar(meas_package);
     }
-
-    //create matrix for sigma points in measurement space
-    Zsig_ = MatrixXd(n_z_, 2 * n_aug_ + 1);
-
-    //mean predicted measurement
-    z_pred_ = VectorXd(n_z_);
-
-    //measurement covariance matrix S
-    S_ = MatrixXd(n_z_, n_z_);
-
-
-    if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
-        PredictRadarMeasurement();
-        // update NIS
-        NIS_radar_ = (meas_package.raw_measurements_-z_pred_).transpose()*S_.inverse()*(meas_package.raw_measurements_-z_pred_);
-    }
-    else if (meas_package.sensor_type_ == MeasurementPackage::LASER) {
-        PredictLaserMeasurement();
-        // update NIS
-        NIS_laser_ = (meas_package.raw_measurements_-z_pred_).transpose()*S_.inverse()*(meas_package.raw_measurements_-z_pred_);
-    }
-
-    UpdateState(meas_package.raw_measurements_);
-
-
-
-}
-
-/**
- * Predicts sigma points, the state, and the state covariance matrix.
- * @param {double} delta_t the change in time (in seconds) between the last
- * measurement and this one.
- */
-void UKF::Prediction(double delta_t) {
-    /**
-    TODO:
-
-    Complete this function! Estimate the object's location. Modify the state
-    vector, x_. Predict sigma points, the state, and the state covariance matrix.
-    */
-
-    MatrixXd Xsig_aug = MatrixXd(n_aug_, 2 * n_aug_ + 1);
-    GenerateAugmentedSigmaPoints(&Xsig_aug);
-    SigmaPointPrediction(Xsig_aug, delta_t);
-    PredictMeanAndCovariance();
 }
 
 /**
@@ -202,14 +168,10 @@ void UKF::Prediction(double delta_t) {
  * @param {MeasurementPackage} meas_package
  */
 void UKF::UpdateLidar(MeasurementPackage meas_package) {
-    /**
-    TODO:
-
-    Complete this function! Use lidar data to update the belief about the object's
-    position. Modify the state vector, x_, and covariance, P_.
-
-    You'll also need to calculate the lidar NIS.
-    */
+    // laser measures px and py directly, so the linear Kalman update is exact
+    NIS_laser_ = UpdateLinear<kLaser>(meas_package.raw_measurements_);
+    ObservedStage stage(observer_, StageObserver::kNISMonitor, kLaser);
+    nis_laser_monitor_.Add(NIS_laser_);
 }
 
 /**
@@ -217,247 +179,101 @@ void UKF::UpdateLidar(MeasurementPackage meas_package) {
  * @param {MeasurementPackage} meas_package
  */
 void UKF::UpdateRadar(MeasurementPackage meas_package) {
-    /**
-    TODO:
-
-    Complete this function! Use radar data to update the belief about the object's
-    position. Modify the state vector, x_, and covariance, P_.
-
-    You'll also need to calculate the radar NIS.
-    */
-
-    PredictRadarMeasurement();
-}
-
-void UKF::GenerateAugmentedSigmaPoints(MatrixXd* Xsig_out) {
-    //create augmented mean vector
-    VectorXd x_aug = VectorXd(7);
-
-    //create augmented state covariance
-    MatrixXd P_aug = MatrixXd(7, 7);
-
-    //create sigma point matrix
-    MatrixXd Xsig_aug = MatrixXd(n_aug_, 2 * n_aug_ + 1);
-
-    //create augmented mean state
-    x_aug.head(5) = x_;
-    x_aug(5) = 0;
-    x_aug(6) = 0;
-
-    //create augmented covariance matrix
-    P_aug.fill(0.0);
-    P_aug.topLeftCorner(5,5) = P_;
-    P_aug(5,5) = std_a_ * std_a_;
-    P_aug(6,6) = std_yawdd_ * std_yawdd_;
-
-    //create square root matrix
-    MatrixXd L = P_aug.llt().matrixL();
-
-    //create augmented sigma points
-    Xsig_aug.col(0)  = x_aug;
-    for (int i = 0; i< n_aug_; i++) {
-        Xsig_aug.col(i+1)        = x_aug + sqrt(lambda_+n_aug_) * L.col(i);
-        Xsig_aug.col(i+1+n_aug_) = x_aug - sqrt(lambda_+n_aug_) * L.col(i);
-    }
-
-    //write result
-    *Xsig_out = Xsig_aug;
+    NIS_radar_ = Update<kRadar>(meas_package.raw_measurements_);
+    ObservedStage stage(observer_, StageObserver::kNISMonitor, kRadar);
+    nis_radar_monitor_.Add(NIS_radar_);
 }
 
-
-void UKF::SigmaPointPrediction(MatrixXd Xsig_aug, double delta_t) {
-    //predict sigma points
-    for (int i = 0; i< 2*n_aug_+1; i++) {
-        //extract values for better readability
-        double p_x = Xsig_aug(0,i);
-        double p_y = Xsig_aug(1,i);
-        double v = Xsig_aug(2,i);
-        double yaw = Xsig_aug(3,i);
-        double yawd = Xsig_aug(4,i);
-        double nu_a = Xsig_aug(5,i);
-        double nu_yawdd = Xsig_aug(6,i);
-
-        //predicted state values
-        double px_p, py_p;
-
-        //avoid division by zero
-        if (fabs(yawd) > 0.001) {
-            px_p = p_x + v/yawd * ( sin (yaw + yawd*delta_t) - sin(yaw));
-            py_p = p_y + v/yawd * ( cos(yaw) - cos(yaw+yawd*delta_t) );
-        }
-        else {
-            px_p = p_x + v*delta_t*cos(yaw);
-            py_p = p_y + v*delta_t*sin(yaw);
-        }
-
-        double v_p = v;
-        double yaw_p = yaw + yawd*delta_t;
-        double yawd_p = yawd;
-
-        //add noise
-        px_p = px_p + 0.5*nu_a*delta_t*delta_t * cos(yaw);
-        py_p = py_p + 0.5*nu_a*delta_t*delta_t * sin(yaw);
-        v_p = v_p + nu_a*delta_t;
-
-        yaw_p = yaw_p + 0.5*nu_yawdd*delta_t*delta_t;
-        yawd_p = yawd_p + nu_yawdd*delta_t;
-
-        //write predicted sigma point into right column
-        Xsig_pred_(0,i) = px_p;
-        Xsig_pred_(1,i) = py_p;
-        Xsig_pred_(2,i) = v_p;
-        Xsig_pred_(3,i) = yaw_p;
-        Xsig_pred_(4,i) = yawd_p;
+GPB1Bank& UKF::Bank() {
+    if (bank_ == NULL) {
+        bank_ = new GPB1Bank(sigma_type_);
+        SetNoise();
     }
+    return *bank_;
 }
 
+void UKF::ProcessBank(const MeasurementPackage &meas_package) {
+    GPB1Bank &bank = Bank();
+    bank.ProcessMeasurement(meas_package);
+    x_ = bank.x_.head<kStateDim>();
+    P_ = bank.P_.topLeftCorner<kStateDim, kStateDim>();
+    sigma_valid_ = false;
 
-void UKF::PredictMeanAndCovariance() {
-    // set weights
-    double weight_0 = lambda_/(lambda_+n_aug_);
-    weights_(0) = weight_0;
-    for (int i=1; i<2*n_aug_+1; i++) {  //2n+1 weights
-        double weight = 0.5/(n_aug_+lambda_);
-        weights_(i) = weight;
-    }
-
-    //predicted state mean
-    x_.fill(0.0);
-    for (int i = 0; i < 2 * n_aug_ + 1; i++) {  //iterate over sigma points
-        x_ = x_+ weights_(i) * Xsig_pred_.col(i);
+    if (meas_package.sensor_type_ == MeasurementPackage::RADAR) {
+        NIS_radar_ = bank.NIS_radar_;
+        ObservedStage stage(observer_, StageObserver::kNISMonitor, kRadar);
+        nis_radar_monitor_.Add(NIS_radar_);
     }
-
-    //predicted state covariance matrix
-    P_.fill(0.0);
-    for (int i = 0; i < 2 * n_aug_ + 1; i++) {  //iterate over sigma points
-
-        // state difference
-        VectorXd x_diff = Xsig_pred_.col(i) - x_;
-        //angle normalization
-        while (x_diff(3)> M_PI) x_diff(3)-=2.*M_PI;
-        while (x_diff(3)<-M_PI) x_diff(3)+=2.*M_PI;
-
-        P_ = P_ + weights_(i) * x_diff * x_diff.transpose() ;
+    else if (meas_package.sensor_type_ == MeasurementPackage::LASER) {
+        NIS_laser_ = bank.NIS_laser_;
+        ObservedStage stage(observer_, StageObserver::kNISMonitor, kLaser);
+        nis_laser_monitor_.Add(NIS_laser_);
     }
 }
 
-
-void UKF::PredictRadarMeasurement() {
-    //transform sigma points into measurement space
-    for (int i = 0; i < 2 * n_aug_ + 1; i++) {  //2n+1 simga points
-
-        // extract values for better readibility
-        double p_x = Xsig_pred_(0,i);
-        double p_y = Xsig_pred_(1,i);
-        double v  = Xsig_pred_(2,i);
-        double yaw = Xsig_pred_(3,i);
-
-        double v1 = cos(yaw)*v;
-        double v2 = sin(yaw)*v;
-
-        // measurement model
-        Zsig_(0,i) = sqrt(p_x*p_x + p_y*p_y);                        //r
-        Zsig_(1,i) = atan2(p_y,p_x);                                 //phi
-
-        if (Zsig_(0, i) <0.001) {
-            Zsig_(2, i) = (p_x * v1 + p_y * v2) / 0.001;        //r_dot
-        } else {
-            Zsig_(2, i) = (p_x * v1 + p_y * v2) / Zsig_(0, i);  //r_dot;
-        }
+void UKF::SetNoise() {
+    SetProcessNoise(NoiseVector(std_a_, std_yawdd_));
+    measurement_model<kRadar>().SetNoise(std_radr_, std_radphi_, std_radrd_);
+    measurement_model<kLaser>().SetNoise(std_laspx_, std_laspy_);
+    if (bank_ != NULL) {
+        bank_->SetNoise(std_a_, std_j_, std_yawdd_);
+        bank_->SetSensors(measurement_model<kRadar>(), measurement_model<kLaser>());
     }
+}
 
-
-    z_pred_.fill(0.0);
-    for (int i=0; i < 2*n_aug_+1; i++) {
-        z_pred_ = z_pred_ + weights_(i) * Zsig_.col(i);
+bool UKF::LoadConfig(const std::string &file_name) {
+    ifstream in(file_name.c_str());
+    if (!in.is_open()) {
+        cerr << "Cannot open config file: " << file_name << endl;
+        return false;
     }
 
+    double std_a = std_a_;
+    double std_yawdd = std_yawdd_;
+    string line;
+    while (getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        istringstream iss(line);
+        string key;
+        double value;
+        if (!(iss >> key)) {
+            continue;
+        }
+        if (!(iss >> value) || value <= 0) {
+            cerr << "Invalid value for " << key << " in " << file_name << endl;
+            return false;
+        }
 
-    S_.fill(0.0);
-    for (int i = 0; i < 2 * n_aug_ + 1; i++) {  //2n+1 simga points
-        //residual
-        VectorXd z_diff = Zsig_.col(i) - z_pred_;
-
-        //angle normalization
-        while (z_diff(1)> M_PI) z_diff(1)-=2.*M_PI;
-        while (z_diff(1)<-M_PI) z_diff(1)+=2.*M_PI;
-
-        S_ = S_ + weights_(i) * z_diff * z_diff.transpose();
+        if (key == "std_a") {
+            std_a = value;
+        }
+        else if (key == "std_yawdd") {
+            std_yawdd = value;
+        }
+        else {
+            cerr << "Unknown key " << key << " in " << file_name << endl;
+            return false;
+        }
     }
 
-    S_ = S_ + R_radar_;
+    std_a_ = std_a;
+    std_yawdd_ = std_yawdd;
+    SetNoise();
+    return true;
 }
 
-void UKF::PredictLaserMeasurement() {
-    //transform sigma points into measurement space
-    for (int i = 0; i < 2 * n_aug_ + 1; i++) {  //2n+1 simga points
-
-        // extract values for better readibility
-        double p_x = Xsig_pred_(0,i);
-        double p_y = Xsig_pred_(1,i);
-
-        // measurement model
-        Zsig_(0,i) = p_x;                        //px
-        Zsig_(1,i) = p_y;                        //py
+bool UKF::SaveConfig(const std::string &file_name, const std::string &comment) const {
+    ofstream out(file_name.c_str());
+    if (!out.is_open()) {
+        cerr << "Cannot open config file: " << file_name << endl;
+        return false;
     }
 
-    z_pred_.fill(0.0);
-    for (int i=0; i < 2*n_aug_+1; i++) {
-        z_pred_ = z_pred_ + weights_(i) * Zsig_.col(i);
+    out.precision(numeric_limits<double>::digits10 + 2);
+    if (!comment.empty()) {
+        out << "# " << comment << "\n";
     }
-
-
-    S_.fill(0.0);
-    for (int i = 0; i < 2 * n_aug_ + 1; i++) {  //2n+1 simga points
-        //residual
-        VectorXd z_diff = Zsig_.col(i) - z_pred_;
-
-        //angle normalization
-        while (z_diff(1)> M_PI) z_diff(1)-=2.*M_PI;
-        while (z_diff(1)<-M_PI) z_diff(1)+=2.*M_PI;
-
-        S_ = S_ + weights_(i) * z_diff * z_diff.transpose();
-    }
-
-    S_ = S_ + R_laser_;
+    out << "std_a " << std_a_ << "\n";
+    out << "std_yawdd " << std_yawdd_ << "\n";
+    return out.good();
 }
-
-
-void UKF::UpdateState(const VectorXd &z) {
-    //create matrix for cross correlation Tc
-    MatrixXd Tc = MatrixXd(n_x_, n_z_);
-
-    //calculate cross correlation matrix
-    Tc.fill(0.0);
-    for (int i = 0; i < 2 * n_aug_ + 1; i++) {  //2n+1 simga points
-
-        //residual
-        VectorXd z_diff = Zsig_.col(i) - z_pred_;
-        //angle normalization
-        while (z_diff(1)> M_PI) z_diff(1)-=2.*M_PI;
-        while (z_diff(1)<-M_PI) z_diff(1)+=2.*M_PI;
-
-        // state difference
-        VectorXd x_diff = Xsig_pred_.col(i) - x_;
-        //angle normalization
-        while (x_diff(3)> M_PI) x_diff(3)-=2.*M_PI;
-        while (x_diff(3)<-M_PI) x_diff(3)+=2.*M_PI;
-
-        Tc = Tc + weights_(i) * x_diff * z_diff.transpose();
-    }
-
-    //Kalman gain K;
-    MatrixXd K = Tc * S_.inverse();
-
-    //residual
-    VectorXd z_diff = z - z_pred_;
-
-    //angle normalization
-    while (z_diff(1)> M_PI) z_diff(1)-=2.*M_PI;
-
-    while (z_diff(1)<-M_PI) z_diff(1)+=2.*M_PI;
-
-    //update state mean and covariance matrix
-    x_ = x_ + K * z_diff;
-    P_ = P_ - K*S_*K.transpose();
-}
\ No newline at end of file
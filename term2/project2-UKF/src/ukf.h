@@ -2,6 +2,12 @@
 #define UKF_H
 
 #include "measurement_package.h"
+#include "sigma_points.h"
+#include "nis_monitor.h"
+#include "process_models.h"
+#include "measurement_models.h"
+#include "unscented_filter.h"
+#include "gpb1_bank.h"
 #include "Eigen/Dense"
 #include <vector>
 #include <string>
@@ -11,8 +17,17 @@
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
 
-class UKF {
+/**
+ * CTRV unscented Kalman filter with radar and laser measurements
+ */
+class UKF : public UnscentedFilter<CtrvModel, RadarModel, LidarModel> {
 public:
+    ///* indices of the measurement models
+    enum {
+        kRadar = 0,
+        kLaser = 1
+    };
+
     ///* initially set to false, set to true in first call of ProcessMeasurement
     bool is_initialized_;
 
@@ -22,14 +37,8 @@ public:
     ///* if this is false, radar measurements will be ignored (except for init)
     bool use_radar_;
 
-    ///* state vector: [pos1 pos2 vel_abs yaw_angle yaw_rate] in SI units and rad
-    VectorXd x_;
-
-    ///* state covariance matrix
-    MatrixXd P_;
-
-    ///* predicted sigma points matrix
-    MatrixXd Xsig_pred_;
+    ///* if this is true, the GPB1 bank bank_ filters and x_, P_ are its combined estimate
+    bool use_bank_;
 
     ///* time when the state is true, in us
     long long time_us_;
@@ -40,6 +49,9 @@ public:
     ///* Process noise standard deviation yaw acceleration in rad/s^2
     double std_yawdd_;
 
+    ///* Process noise standard deviation longitudinal jerk of the bank's CTRA model in m/s^3
+    double std_j_;
+
     ///* Laser measurement noise standard deviation position1 in m
     double std_laspx_;
 
@@ -55,28 +67,31 @@ public:
     ///* Radar measurement noise standard deviation radius change in m/s
     double std_radrd_ ;
 
-    ///* Weights of sigma points
-    VectorXd weights_;
-
-    ///* State dimension
-    int n_x_;
-
-    ///* Augmented state dimension
-    int n_aug_;
-
-    ///* Sigma point spreading parameter
-    double lambda_;
-
     ///* the current NIS for radar
     double NIS_radar_;
 
     ///* the current NIS for laser
     double NIS_laser_;
 
+    ///* number of measurements dropped because they were older than the state
+    long out_of_order_;
+
+    ///* chi-square consistency of the radar NIS over a sliding window
+    NISMonitor nis_radar_monitor_;
+
+    ///* chi-square consistency of the laser NIS over a sliding window
+    NISMonitor nis_laser_monitor_;
+
+    ///* CV, CTRV and CTRA models, used instead of the CTRV filter if use_bank_ is set;
+    ///* NULL until the first measurement with use_bank_, owned
+    GPB1Bank *bank_;
+
     /**
      * Constructor
+     * @param sigma_type Sigma point strategy; SPHERICAL_SIMPLEX propagates n+2
+     * instead of 2n+1 points at a small cost in accuracy
      */
-    UKF();
+    explicit UKF(SigmaPoints::Type sigma_type = SigmaPoints::SYMMETRIC);
 
     /**
      * Destructor
@@ -84,18 +99,12 @@ public:
     virtual ~UKF();
 
     /**
-     * ProcessMeasurement
+     * ProcessMeasurement Predicts to the time of the measurement and updates with it.
+     * Measurements older than the state are dropped and counted in out_of_order_.
      * @param meas_package The latest measurement data of either radar or laser
      */
     void ProcessMeasurement(MeasurementPackage meas_package);
 
-    /**
-     * Prediction Predicts sigma points, the state, and the state covariance
-     * matrix
-     * @param delta_t Time between k and k+1 in s
-     */
-    void Prediction(double delta_t);
-
     /**
      * Updates the state and the state covariance matrix using a laser measurement
      * @param meas_package The measurement at k+1
@@ -108,33 +117,51 @@ public:
      */
     void UpdateRadar(MeasurementPackage meas_package);
 
+    void PredictRadarMeasurement() { PredictMeasurement<kRadar>(); }
+    void PredictLaserMeasurement() { PredictMeasurement<kLaser>(); }
 
-    void GenerateAugmentedSigmaPoints(MatrixXd* Xsig_out);
-    void SigmaPointPrediction(MatrixXd Xsig_aug, double delta_t);
-    void PredictMeanAndCovariance();
-    void PredictRadarMeasurement();
-    void PredictLaserMeasurement();
-    void UpdateState(const VectorXd &z);
+    /**
+     * SetNoise Applies std_a_, std_yawdd_ and the sensor standard deviations
+     * to the process and measurement models
+     */
+    void SetNoise();
 
-private:
-    // previous timestamp
-    long previous_timestamp_;
+    /**
+     * LoadConfig Reads "key value" lines (std_a, std_yawdd) from a config file,
+     * e.g. written by TuneNoise, and applies them; '#' starts a comment
+     * @return false if the file cannot be read or has an unknown key
+     */
+    bool LoadConfig(const std::string &file_name);
 
-    //set measurement dimension, radar can measure r, phi, and r_dot
-    int n_z_;
+    /**
+     * SaveConfig Writes std_a_ and std_yawdd_ in the format read by LoadConfig
+     */
+    bool SaveConfig(const std::string &file_name, const std::string &comment = "") const;
 
-    //create matrix for sigma points in measurement space
-    MatrixXd Zsig_;
+    /**
+     * Time steps from 0 to shorter than this (in s) skip the prediction. The state
+     * keeps its time, so the skipped interval is covered by the next prediction.
+     */
+    static const double kMinDeltaT;
 
-    //mean predicted measurement
-    VectorXd z_pred_;
+private:
+    // the bank has the filter's sigma point set
+    SigmaPoints::Type sigma_type_;
 
-    //measurement covariance matrix S
-    MatrixXd S_;
+    // the bank is owned, no copies
+    UKF(const UKF&);
+    UKF& operator=(const UKF&);
 
-    //measurement noise covariance matrix
-    MatrixXd R_laser_, R_radar_;
+    /**
+     * Bank Returns bank_, constructed with the current noise on first use
+     */
+    GPB1Bank& Bank();
 
+    /**
+     * ProcessBank Runs a measurement through bank_ and takes over its combined
+     * estimate, the CTRV components of [px py v yaw yawd a]
+     */
+    void ProcessBank(const MeasurementPackage &meas_package);
 };
 
 #endif /* UKF_H */
@@ -0,0 +1,521 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Eigen/Dense"
+#include "ukf.h"
+#include "tools.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using Eigen::VectorXd;
+
+/**
+ * Per-stage profile of the UKF: wall time, heap allocations and (on Linux,
+ * if perf events are permitted) last level cache misses of every stage the
+ * filter reports to its StageObserver, on the production ProcessMeasurement.
+ *
+ * Runs on the given logs and on a synthetic CTRV track of any length.
+ * Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+ */
+
+/*****************************************************************************
+ * Allocation counting
+ ****************************************************************************/
+
+static unsigned long long g_allocations = 0;
+
+#if defined(__GLIBC__)
+// count on the malloc level, that covers operator new and Eigen's aligned_malloc
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+    g_allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    g_allocations++;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    g_allocations++;
+    return __libc_realloc(ptr, size);
+}
+}
+#else
+void* operator new(size_t size) {
+    g_allocations++;
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+#endif
+
+namespace {
+
+/*****************************************************************************
+ * Cache miss counter
+ ****************************************************************************/
+
+class CacheMissCounter {
+public:
+    CacheMissCounter() : fd_(-1) {
+#if defined(__linux__)
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fd_ >= 0) {
+            ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    ~CacheMissCounter() {
+#if defined(__linux__)
+        if (fd_ >= 0) close(fd_);
+#endif
+    }
+
+    bool Available() const { return fd_ >= 0; }
+
+    unsigned long long Read() const {
+        unsigned long long count = 0;
+#if defined(__linux__)
+        if (fd_ >= 0 && ::read(fd_, &count, sizeof(count)) != sizeof(count)) {
+            count = 0;
+        }
+#endif
+        return count;
+    }
+
+private:
+    int fd_;
+};
+
+/*****************************************************************************
+ * Stage statistics
+ ****************************************************************************/
+
+const int kModels = 2;
+
+const char* kStageNames[StageObserver::kStages] = {
+    "GenerateSigmaPoints",
+    "SigmaPointPrediction",
+    "PredictMeanAndCovariance",
+    "PredictMeasurement",
+    "UpdateState",
+    "UpdateLinear",
+    "NISMonitor"
+};
+
+// indexed by UKF::kRadar and UKF::kLaser
+const char* kModelNames[kModels] = {"radar", "laser"};
+
+struct StageStats {
+    unsigned long long calls;
+    double ns;
+    unsigned long long allocations;
+    unsigned long long cache_misses;
+};
+
+typedef chrono::steady_clock Clock;
+
+/**
+ * Adds time, allocations and cache misses of every stage call to the
+ * statistics of the stage and measurement model; stages do not nest
+ */
+class StageProfiler : public StageObserver {
+public:
+    explicit StageProfiler(const CacheMissCounter& misses)
+        : misses_(misses), allocations_(0), cache_misses_(0) {
+        memset(stats_, 0, sizeof(stats_));
+    }
+
+    void Begin(Stage /* stage */, int /* model */) {
+        allocations_ = g_allocations;
+        cache_misses_ = misses_.Read();
+        start_ = Clock::now();
+    }
+
+    void End(Stage stage, int model) {
+        Clock::time_point end = Clock::now();
+        StageStats& stats = stats_[stage][model + 1];
+        stats.calls++;
+        stats.ns += chrono::duration<double, nano>(end - start_).count();
+        stats.allocations += g_allocations - allocations_;
+        stats.cache_misses += misses_.Read() - cache_misses_;
+    }
+
+    ///* statistics of a stage, model -1 for the process stages
+    const StageStats& stats(int stage, int model) const { return stats_[stage][model + 1]; }
+
+private:
+    const CacheMissCounter& misses_;
+    StageStats stats_[kStages][kModels + 1];
+    unsigned long long allocations_;
+    unsigned long long cache_misses_;
+    Clock::time_point start_;
+};
+
+/*****************************************************************************
+ * Inputs
+ ****************************************************************************/
+
+struct Run {
+    string name;
+    vector<MeasurementPackage> measurements;
+    vector<GroundTruthPackage> ground_truth;
+};
+
+/**
+ * Synthetic CTRV track with random longitudinal and yaw accelerations,
+ * alternating laser and radar measurements every 50 ms
+ */
+Run SyntheticRun(size_t n_measurements, unsigned int seed) {
+    UKF defaults;
+    mt19937 gen(seed);
+    normal_distribution<double> noise(0.0, 1.0);
+
+    Run run;
+    ostringstream name;
+    name << "synthetic (" << n_measurements << " measurements)";
+    run.name = name.str();
+
+    const double dt = 0.05;
+    double px = 5, py = 1, v = 3, yaw = 0.3, yawd = 0.1;
+    long long timestamp = 1477010443000000LL;
+    for (size_t k = 0; k < n_measurements; k++) {
+        // keep the target near the sensor
+        double a = 0.5 * noise(gen) - 0.05 * (v - 3);
+        double yawdd = 0.3 * noise(gen) - 0.5 * yawd;
+        if (px * px + py * py > 30 * 30) {
+            // turn back towards the sensor
+            double heading_error = atan2(-py, -px) - yaw;
+            yawdd += 0.5 * atan2(sin(heading_error), cos(heading_error));
+        }
+        px += v * cos(yaw) * dt;
+        py += v * sin(yaw) * dt;
+        v += a * dt;
+        yaw += yawd * dt;
+        yawd += yawdd * dt;
+        timestamp += static_cast<long long>(dt * 1e6);
+
+        MeasurementPackage meas;
+        meas.timestamp_ = timestamp;
+        if (k % 2 == 0) {
+            meas.sensor_type_ = MeasurementPackage::LASER;
+            meas.raw_measurements_ = VectorXd(2);
+            meas.raw_measurements_ << px + defaults.std_laspx_ * noise(gen),
+                                      py + defaults.std_laspy_ * noise(gen);
+        }
+        else {
+            meas.sensor_type_ = MeasurementPackage::RADAR;
+            meas.raw_measurements_ = VectorXd(3);
+            double rho = sqrt(px * px + py * py);
+            meas.raw_measurements_ << rho + defaults.std_radr_ * noise(gen),
+                                      atan2(py, px) + defaults.std_radphi_ * noise(gen),
+                                      (px * v * cos(yaw) + py * v * sin(yaw)) / rho + defaults.std_radrd_ * noise(gen);
+        }
+        run.measurements.push_back(meas);
+
+        GroundTruthPackage gt;
+        gt.gt_values_ = VectorXd(4);
+        gt.gt_values_ << px, py, v * cos(yaw), v * sin(yaw);
+        run.ground_truth.push_back(gt);
+    }
+    return run;
+}
+
+/*****************************************************************************
+ * Benchmark
+ ****************************************************************************/
+
+typedef UnscentedFilter<CvModel, RadarModel, LidarModel> CvFilter;
+typedef UnscentedFilter<CtrvModel, RadarModel, LidarModel> CtrvFilter;
+typedef UnscentedFilter<CtraModel, RadarModel, LidarModel> CtraFilter;
+
+/**
+ * Runs one filter of the bank's models on its own over the measurements,
+ * the way the bank runs it: initialized at the first position, predicted
+ * in steps of GPB1Bank::kMaxStep and updated with every measurement
+ * @param noise Process noise standard deviations of the model
+ * @return time in ns
+ */
+template <class Filter>
+double RunSeparate(const vector<MeasurementPackage>& measurements, SigmaPoints::Type sigma_type,
+                   const typename Filter::NoiseVector& noise, UKF& sensors) {
+    Filter filter(SigmaPoints(sigma_type, Filter::kAugDim,
+                              sigma_type == SigmaPoints::SYMMETRIC ? 3 - Filter::kStateDim : 0.0));
+    filter.SetProcessNoise(noise);
+    filter.template measurement_model<UKF::kRadar>() = sensors.measurement_model<UKF::kRadar>();
+    filter.template measurement_model<UKF::kLaser>() = sensors.measurement_model<UKF::kLaser>();
+
+    typename Filter::StateSigmaMatrix Xsig_state(int(Filter::kStateDim), filter.n_sig_);
+    long long time_us = 0;
+    Clock::time_point start = Clock::now();
+    for (size_t k = 0; k < measurements.size(); k++) {
+        const MeasurementPackage& meas = measurements[k];
+        if (k == 0) {
+            filter.x_.setZero();
+            if (meas.sensor_type_ == MeasurementPackage::RADAR) {
+                filter.x_(0) = meas.raw_measurements_(0) * cos(meas.raw_measurements_(1));
+                filter.x_(1) = meas.raw_measurements_(0) * sin(meas.raw_measurements_(1));
+            }
+            else {
+                filter.x_.template head<2>() = meas.raw_measurements_;
+            }
+            filter.P_.setIdentity();
+            time_us = meas.timestamp_;
+            continue;
+        }
+
+        double dt = (meas.timestamp_ - time_us) / 1000000.0;
+        if (dt >= UKF::kMinDeltaT) {
+            time_us = meas.timestamp_;
+            filter.GenerateStateSigmaPoints(&Xsig_state);
+            filter.Prediction(Xsig_state, dt, GPB1Bank::kMaxStep);
+        }
+        if (meas.sensor_type_ == MeasurementPackage::RADAR) {
+            filter.template Update<UKF::kRadar>(RadarModel::Vector(meas.raw_measurements_));
+        }
+        else {
+            filter.template UpdateLinear<UKF::kLaser>(LidarModel::Vector(meas.raw_measurements_));
+        }
+    }
+    return chrono::duration<double, nano>(Clock::now() - start).count();
+}
+
+/**
+ * Runs the CTRV filter with a sigma point set over the measurements
+ * @param estimations Receives the estimates if not NULL
+ * @return time in ns
+ */
+double RunCtrv(const Run& run, SigmaPoints::Type sigma_type, vector<VectorXd>* estimations) {
+    UKF ukf(sigma_type);
+    Clock::time_point start = Clock::now();
+    for (size_t k = 0; k < run.measurements.size(); k++) {
+        ukf.ProcessMeasurement(run.measurements[k]);
+        if (estimations != NULL) {
+            VectorXd estimate(4);
+            estimate << ukf.x_(0), ukf.x_(1), ukf.x_(2) * cos(ukf.x_(3)), ukf.x_(2) * sin(ukf.x_(3));
+            estimations->push_back(estimate);
+        }
+    }
+    return chrono::duration<double, nano>(Clock::now() - start).count();
+}
+
+void Benchmark(const Run& run, SigmaPoints::Type sigma_type, int repeats, const CacheMissCounter& misses) {
+    cout << endl << "== " << run.name << ", " << repeats << " repeat(s), "
+         << (sigma_type == SigmaPoints::SYMMETRIC ? "symmetric" : "spherical simplex") << " sigma points" << endl;
+
+    // end to end with the production code path, one filter tracks one object: the
+    // single CTRV filter, the CV/CTRV/CTRA bank and, as the budget of the bank, its
+    // models as three separate filters; the runs alternate and the fastest counts
+    double ctrv_ns = 0, bank_ns = 0, separate_ns = 0;
+    unsigned long long ctrv_allocations = 0, bank_allocations = 0;
+    long transformed = 0;
+    long reused = 0;
+    for (int r = 0; r < repeats; r++) {
+        for (int bank = 0; bank < 2; bank++) {
+            UKF ukf(sigma_type);
+            ukf.use_bank_ = bank != 0;
+            unsigned long long allocations = g_allocations;
+            Clock::time_point start = Clock::now();
+            for (size_t k = 0; k < run.measurements.size(); k++) {
+                ukf.ProcessMeasurement(run.measurements[k]);
+            }
+            double ns = chrono::duration<double, nano>(Clock::now() - start).count();
+            allocations = g_allocations - allocations;
+            if (bank) {
+                bank_ns = r == 0 ? ns : min(bank_ns, ns);
+                bank_allocations = allocations;
+                transformed = ukf.bank_->transformed_points_;
+                reused = ukf.bank_->reused_points_;
+            }
+            else {
+                ctrv_ns = r == 0 ? ns : min(ctrv_ns, ns);
+                ctrv_allocations = allocations;
+            }
+        }
+
+        UKF sensors;
+        double ns = RunSeparate<CvFilter>(run.measurements, sigma_type,
+                                          CvFilter::NoiseVector(sensors.std_a_, sensors.std_yawdd_), sensors);
+        ns += RunSeparate<CtrvFilter>(run.measurements, sigma_type,
+                                      CtrvFilter::NoiseVector(sensors.std_a_, sensors.std_yawdd_), sensors);
+        ns += RunSeparate<CtraFilter>(run.measurements, sigma_type,
+                                      CtraFilter::NoiseVector(sensors.std_j_, sensors.std_yawdd_), sensors);
+        separate_ns = r == 0 ? ns : min(separate_ns, ns);
+    }
+
+    const double n = static_cast<double>(run.measurements.size());
+    cout << "ProcessMeasurement: " << ctrv_ns / n << " ns/measurement per object, "
+         << 1e9 * n / ctrv_ns << " measurements/s, " << ctrv_allocations / n << " allocations/measurement" << endl;
+    cout << "ProcessMeasurement (GPB1 bank): " << bank_ns / n << " ns/measurement per object, "
+         << 1e9 * n / bank_ns << " measurements/s, " << bank_allocations / n << " allocations/measurement, "
+         << bank_ns / ctrv_ns << "x CTRV, " << bank_ns / separate_ns << "x CV, CTRV and CTRA as separate filters ("
+         << separate_ns / n << " ns/measurement), "
+         << 100.0 * reused / max(1L, transformed + reused) << "% radar h(x) reused" << endl;
+
+    // the CTRV filter with either sigma point set, alternating, the fastest counts
+    const SigmaPoints::Type sigma_types[2] = {SigmaPoints::SYMMETRIC, SigmaPoints::SPHERICAL_SIMPLEX};
+    const char* sigma_names[2] = {"symmetric", "spherical simplex"};
+    double sigma_ns[2] = {0, 0};
+    for (int r = 0; r < repeats; r++) {
+        for (int t = 0; t < 2; t++) {
+            double ns = RunCtrv(run, sigma_types[t], NULL);
+            sigma_ns[t] = r == 0 ? ns : min(sigma_ns[t], ns);
+        }
+    }
+    Tools tools;
+    for (int t = 0; t < 2; t++) {
+        vector<VectorXd> estimations;
+        RunCtrv(run, sigma_types[t], &estimations);
+        vector<VectorXd> ground_truth;
+        for (size_t k = 0; k < run.ground_truth.size(); k++) {
+            ground_truth.push_back(run.ground_truth[k].gt_values_);
+        }
+        cout << "Sigma points " << sigma_names[t] << " (" << UKF(sigma_types[t]).n_sig_
+             << "): " << sigma_ns[t] / n << " ns/measurement, ";
+        if (t > 0) {
+            cout << sigma_ns[t] / sigma_ns[0] << "x symmetric, ";
+        }
+        cout << "RMSE: " << tools.CalculateRMSE(estimations, ground_truth).transpose() << endl;
+    }
+
+    // stage by stage, the same code path reporting to a profiler
+    StageProfiler profiler(misses);
+    vector<VectorXd> estimations;
+    vector<VectorXd> ground_truth;
+    for (int r = 0; r < repeats; r++) {
+        UKF ukf(sigma_type);
+        ukf.SetStageObserver(&profiler);
+        for (size_t k = 0; k < run.measurements.size(); k++) {
+            ukf.ProcessMeasurement(run.measurements[k]);
+            if (r == 0) {
+                VectorXd estimate(4);
+                estimate << ukf.x_(0), ukf.x_(1), ukf.x_(2) * cos(ukf.x_(3)), ukf.x_(2) * sin(ukf.x_(3));
+                estimations.push_back(estimate);
+                ground_truth.push_back(run.ground_truth[k].gt_values_);
+            }
+        }
+    }
+
+    cout << "RMSE: " << tools.CalculateRMSE(estimations, ground_truth).transpose() << endl;
+
+    cout << left << setw(32) << "stage" << right << setw(10) << "calls" << setw(12) << "ns/call"
+         << setw(12) << "total ms" << setw(14) << "allocs/call";
+    if (misses.Available()) {
+        cout << setw(14) << "misses/call";
+    }
+    cout << endl;
+
+    for (int s = 0; s < StageObserver::kStages; s++) {
+        for (int m = -1; m < kModels; m++) {
+            const StageStats& stats = profiler.stats(s, m);
+            if (stats.calls == 0) {
+                continue;
+            }
+            string name = kStageNames[s];
+            if (m >= 0) {
+                name = name + " (" + kModelNames[m] + ")";
+            }
+            double calls = static_cast<double>(stats.calls);
+            cout << left << setw(32) << name << right << setw(10) << stats.calls
+                 << setw(12) << fixed << setprecision(1) << stats.ns / calls
+                 << setw(12) << setprecision(3) << stats.ns * 1e-6
+                 << setw(14) << setprecision(2) << stats.allocations / calls;
+            if (misses.Available()) {
+                cout << setw(14) << setprecision(2) << stats.cache_misses / calls;
+            }
+            cout << endl;
+            cout.unsetf(ios::floatfield);
+            cout << setprecision(6);
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    string usage_instructions = "Usage instructions: ";
+    usage_instructions += argv[0];
+    usage_instructions += " [-n synthetic_measurements] [-r repeats] [--simplex] [path/to/input.txt ...]";
+
+    size_t n_synthetic = 100000;
+    int repeats = 3;
+    // sigma point set of the filter, the bank and the separate filters
+    SigmaPoints::Type sigma_type = SigmaPoints::SYMMETRIC;
+    vector<string> inputs;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if ((arg == "-n" || arg == "-r") && i + 1 < argc) {
+            if (arg == "-n") n_synthetic = static_cast<size_t>(atol(argv[++i]));
+            else repeats = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--simplex") {
+            sigma_type = SigmaPoints::SPHERICAL_SIMPLEX;
+        }
+        else if (arg[0] == '-') {
+            cerr << usage_instructions << endl;
+            exit(EXIT_FAILURE);
+        }
+        else {
+            inputs.push_back(arg);
+        }
+    }
+
+    CacheMissCounter misses;
+    if (!misses.Available()) {
+        cout << "Cache miss counter not available on this platform or not permitted" << endl;
+    }
+
+    Tools tools;
+    UKF defaults;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        ifstream in_file(inputs[i].c_str(), ifstream::in);
+        if (!in_file.is_open()) {
+            cerr << "Cannot open input file: " << inputs[i] << endl;
+            exit(EXIT_FAILURE);
+        }
+        Run run;
+        run.name = inputs[i];
+        tools.ReadMeasurements(in_file, defaults.use_laser_, defaults.use_radar_,
+                               &run.measurements, &run.ground_truth);
+        Benchmark(run, sigma_type, repeats, misses);
+    }
+
+    if (n_synthetic > 0) {
+        Benchmark(SyntheticRun(n_synthetic, 42), sigma_type, repeats, misses);
+    }
+    return 0;
+}
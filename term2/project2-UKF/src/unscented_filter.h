@@ -0,0 +1,486 @@
+#ifndef UNSCENTED_FILTER_H_
+#define UNSCENTED_FILTER_H_
+
+#include <cmath>
+#include <tuple>
+#include "Eigen/Dense"
+#include "sigma_points.h"
+
+/**
+ * NormalizeAngles Wraps the rows of M flagged in the bit mask kAngles to [-pi, pi]
+ */
+template <int kAngles, typename Derived>
+inline void NormalizeAngles(Eigen::MatrixBase<Derived> &M) {
+    for (int r = 0; r < M.rows(); r++) {
+        if (!(kAngles & (1 << r))) continue;
+        for (int c = 0; c < M.cols(); c++) {
+            while (M(r, c) >  M_PI) M(r, c) -= 2. * M_PI;
+            while (M(r, c) < -M_PI) M(r, c) += 2. * M_PI;
+        }
+    }
+}
+
+/**
+ * Observer of the filter stages, e.g. a profiler. Begin and End bracket every
+ * call of a stage; model is the measurement model index, -1 for the process
+ * stages. Without an observer a stage costs one pointer test.
+ */
+class StageObserver {
+public:
+    enum Stage {
+        kGenerateSigmaPoints,
+        kSigmaPointPrediction,
+        kPredictMeanAndCovariance,
+        kPredictMeasurement,
+        kUpdateState,
+        kUpdateLinear,
+        kNISMonitor,
+        kStages
+    };
+
+    virtual ~StageObserver() {}
+
+    virtual void Begin(Stage stage, int model) = 0;
+    virtual void End(Stage stage, int model) = 0;
+};
+
+/**
+ * Calls Begin and End of an optional observer around a scope
+ */
+class ObservedStage {
+public:
+    ObservedStage(StageObserver *observer, StageObserver::Stage stage, int model = -1)
+        : observer_(observer), stage_(stage), model_(model) {
+        if (observer_ != NULL) observer_->Begin(stage_, model_);
+    }
+
+    ~ObservedStage() {
+        if (observer_ != NULL) observer_->End(stage_, model_);
+    }
+
+private:
+    StageObserver *observer_;
+    StageObserver::Stage stage_;
+    int model_;
+};
+
+/**
+ * Unscented Kalman filter over a process model and a list of measurement
+ * models (see process_models.h and measurement_models.h).
+ *
+ * All dimensions are known at compile time, so the sigma point matrices are
+ * fixed-size and the models are called without any runtime dispatch.
+ * Measurement models are addressed by their index I in MeasurementModels.
+ */
+template <class ProcessModel, class... MeasurementModels>
+class UnscentedFilter {
+public:
+    enum {
+        kStateDim = ProcessModel::kStateDim,
+        kNoiseDim = ProcessModel::kNoiseDim,
+        kAugDim = kStateDim + kNoiseDim,
+        kMaxSigma = 2 * kAugDim + 1
+    };
+
+    typedef Eigen::Matrix<double, kStateDim, 1> StateVector;
+    typedef Eigen::Matrix<double, kStateDim, kStateDim> StateMatrix;
+    typedef Eigen::Matrix<double, kNoiseDim, 1> NoiseVector;
+    typedef Eigen::Matrix<double, kAugDim, 1> AugmentedVector;
+    typedef Eigen::Matrix<double, kAugDim, Eigen::Dynamic, 0, kAugDim, kMaxSigma> AugmentedSigmaMatrix;
+    typedef Eigen::Matrix<double, kStateDim, Eigen::Dynamic, 0, kStateDim, kMaxSigma> StateSigmaMatrix;
+    typedef Eigen::Matrix<double, kNoiseDim, Eigen::Dynamic, 0, kNoiseDim, kMaxSigma> NoiseSigmaMatrix;
+    typedef Eigen::Matrix<double, Eigen::Dynamic, 1, 0, kMaxSigma, 1> WeightVector;
+
+    /**
+     * Measurement model I
+     */
+    template <int I>
+    struct ModelType {
+        typedef typename std::tuple_element<I, std::tuple<MeasurementModels...> >::type type;
+    };
+
+    /**
+     * Predicted measurement: sigma points in measurement space, mean and covariance S
+     */
+    template <class MeasurementModel>
+    struct MeasurementPrediction {
+        enum { kDim = MeasurementModel::kDim };
+
+        typedef Eigen::Matrix<double, kDim, 1> Vector;
+        typedef Eigen::Matrix<double, kDim, kDim> Matrix;
+        typedef Eigen::Matrix<double, kDim, Eigen::Dynamic, 0, kDim, kMaxSigma> SigmaMatrix;
+
+        SigmaMatrix Zsig_;
+        Vector z_pred_;
+        Matrix S_;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    template <int I>
+    struct PredictionType {
+        typedef MeasurementPrediction<typename ModelType<I>::type> type;
+    };
+
+    ///* state vector
+    StateVector x_;
+
+    ///* state covariance matrix
+    StateMatrix P_;
+
+    ///* predicted sigma points matrix
+    StateSigmaMatrix Xsig_pred_;
+
+    ///* Weights of sigma points
+    WeightVector weights_;
+
+    ///* Number of sigma points
+    int n_sig_;
+
+    /**
+     * Constructor
+     * @param sigma_points Sigma point set of dimension kAugDim
+     */
+    explicit UnscentedFilter(const SigmaPoints &sigma_points)
+        : x_(StateVector::Zero()),
+          P_(StateMatrix::Identity()),
+          weights_(sigma_points.Weights()),
+          n_sig_(sigma_points.Size()),
+          U_state_(sigma_points.UnitPoints().topRows(kStateDim)),
+          U_noise_(sigma_points.UnitPoints().bottomRows(kNoiseDim)),
+          sigma_valid_(false),
+          observer_(NULL) {
+        Xsig_pred_.resize(kStateDim, n_sig_);
+        SetProcessNoise(NoiseVector::Zero());
+    }
+
+    virtual ~UnscentedFilter() {}
+
+    ///* process model
+    ProcessModel& process_model() { return process_; }
+
+    ///* process noise standard deviations
+    const NoiseVector& process_noise_std() const { return process_noise_std_; }
+
+    /**
+     * SetProcessNoise Sets the process noise standard deviations. The noise
+     * block of the augmented covariance is diagonal and constant, so the noise
+     * rows of the augmented sigma points, diag(std) * U, are computed here once.
+     */
+    void SetProcessNoise(const NoiseVector &std) {
+        process_noise_std_ = std;
+        noise_sigma_ = process_noise_std_.asDiagonal() * U_noise_;
+    }
+
+    /**
+     * SetStageObserver Reports every stage to observer, NULL (the default) for none
+     */
+    void SetStageObserver(StageObserver *observer) { observer_ = observer; }
+
+    StageObserver* stage_observer() const { return observer_; }
+
+    ///* measurement model I
+    template <int I>
+    typename ModelType<I>::type& measurement_model() { return std::get<I>(models_); }
+
+    ///* latest predicted measurement of model I
+    template <int I>
+    typename PredictionType<I>::type& predicted_measurement() { return std::get<I>(predictions_); }
+
+    /**
+     * Prediction Predicts sigma points, the state, and the state covariance matrix
+     * @param delta_t Time between k and k+1 in s
+     */
+    void Prediction(double delta_t) {
+        AugmentedSigmaMatrix Xsig_aug(int(kAugDim), n_sig_);
+        {
+            ObservedStage stage(observer_, StageObserver::kGenerateSigmaPoints);
+            GenerateAugmentedSigmaPoints(&Xsig_aug);
+        }
+        PredictFrom(&Xsig_aug, delta_t, delta_t);
+    }
+
+    /**
+     * Prediction Predicts from given state rows of the augmented sigma points,
+     * e.g. rows shared by several filters with the same sigma point set.
+     * Intervals longer than max_step are integrated in steps of max_step / 2
+     * moving the same sigma points, no new points are drawn in between.
+     * @param Xsig_state State rows of the sigma points, see GenerateStateSigmaPoints
+     * @param delta_t Time between k and k+1 in s
+     * @param max_step Longest single step in s
+     */
+    void Prediction(const StateSigmaMatrix &Xsig_state, double delta_t, double max_step) {
+        AugmentedSigmaMatrix Xsig_aug(int(kAugDim), n_sig_);
+        AugmentSigmaPoints(Xsig_state, &Xsig_aug);
+        PredictFrom(&Xsig_aug, delta_t, max_step);
+    }
+
+    /**
+     * AugmentSigmaPoints Augmented sigma points of given state rows and the
+     * noise rows of this filter
+     */
+    void AugmentSigmaPoints(const StateSigmaMatrix &Xsig_state, AugmentedSigmaMatrix* Xsig_aug) const {
+        Xsig_aug->template topRows<kStateDim>() = Xsig_state;
+        Xsig_aug->template bottomRows<kNoiseDim>() = noise_sigma_;
+    }
+
+    /**
+     * CompletePrediction Predicted state and covariance of Xsig_pred_ as filled
+     * in by the caller, e.g. a bank stepping the sigma points of several filters
+     * in one loop
+     */
+    void CompletePrediction() {
+        ObservedStage stage(observer_, StageObserver::kPredictMeanAndCovariance);
+        PredictMeanAndCovariance();
+        sigma_valid_ = true;
+    }
+
+    /**
+     * GenerateStateSigmaPoints Sigma points of x_ and P_, x + chol(P) * U
+     */
+    void GenerateStateSigmaPoints(StateSigmaMatrix* Xsig_out) const {
+        Eigen::LLT<StateMatrix> P_llt(P_);
+        Xsig_out->noalias() = P_llt.matrixL() * U_state_;
+        Xsig_out->colwise() += x_;
+    }
+
+    ///* true while Xsig_pred_ is the sigma point set of the current x_ and P_
+    bool sigma_points_valid() const { return sigma_valid_; }
+
+    /**
+     * RefreshSigmaPoints Rebuilds Xsig_pred_ from x_ and P_ without a process
+     * step, for an update at the time of the previous update. With delta_t = 0
+     * the process model is the identity, so the state rows of the augmented
+     * sigma points are the predicted sigma points and x_, P_ stay as they are.
+     */
+    void RefreshSigmaPoints() {
+        ObservedStage stage(observer_, StageObserver::kGenerateSigmaPoints);
+        GenerateStateSigmaPoints(&Xsig_pred_);
+        sigma_valid_ = true;
+    }
+
+    /**
+     * GenerateAugmentedSigmaPoints The augmented covariance is block diagonal,
+     * diag(P, Q), so only P is factorized: the state rows are x + chol(P) * U
+     * and the noise rows (zero mean) are the precomputed diag(std) * U.
+     */
+    void GenerateAugmentedSigmaPoints(AugmentedSigmaMatrix* Xsig_out) const {
+        AugmentedSigmaMatrix& Xsig_aug = *Xsig_out;
+
+        //create square root matrix of the state block
+        Eigen::LLT<StateMatrix> P_llt(P_);
+
+        //create augmented sigma points
+        Xsig_aug.template topRows<kStateDim>().noalias() = P_llt.matrixL() * U_state_;
+        Xsig_aug.template topRows<kStateDim>().colwise() += x_;
+        Xsig_aug.template bottomRows<kNoiseDim>() = noise_sigma_;
+    }
+
+    void SigmaPointPrediction(const AugmentedSigmaMatrix &Xsig_aug, double delta_t) {
+        for (int i = 0; i < n_sig_; i++) {
+            Xsig_pred_.col(i) = process_(Xsig_aug.col(i), delta_t);
+        }
+    }
+
+    void PredictMeanAndCovariance() {
+        //predicted state mean
+        x_.noalias() = Xsig_pred_ * weights_;
+
+        //predicted state covariance matrix
+        StateSigmaMatrix X_diff = Xsig_pred_.colwise() - x_;
+        NormalizeAngles<ProcessModel::kAngles>(X_diff);
+        P_.noalias() = X_diff * weights_.asDiagonal() * X_diff.transpose();
+    }
+
+    /**
+     * PredictMeasurement Transforms the predicted sigma points with measurement
+     * model I and computes the predicted measurement mean and covariance S
+     */
+    template <int I>
+    void PredictMeasurement() {
+        typedef typename ModelType<I>::type M;
+        typedef typename PredictionType<I>::type P;
+        const M& model = measurement_model<I>();
+        P& pred = predicted_measurement<I>();
+
+        //an earlier update at this time changed x_ and P_
+        if (!sigma_valid_) {
+            RefreshSigmaPoints();
+        }
+        ObservedStage stage(observer_, StageObserver::kPredictMeasurement, I);
+
+        //transform sigma points into measurement space
+        pred.Zsig_.resize(int(P::kDim), n_sig_);
+        for (int i = 0; i < n_sig_; i++) {
+            pred.Zsig_.col(i) = model(Xsig_pred_.col(i));
+        }
+
+        PredictMeasurementMoments<I>();
+    }
+
+    /**
+     * PredictMeasurementMoments Mean and covariance S of the measurement sigma
+     * points in predicted_measurement<I>().Zsig_, for callers that transform
+     * the sigma points of Xsig_pred_ themselves
+     */
+    template <int I>
+    void PredictMeasurementMoments() {
+        typedef typename ModelType<I>::type M;
+        typedef typename PredictionType<I>::type P;
+        const M& model = measurement_model<I>();
+        P& pred = predicted_measurement<I>();
+
+        //mean predicted measurement
+        pred.z_pred_.noalias() = pred.Zsig_ * weights_;
+
+        //measurement covariance matrix S
+        typename P::SigmaMatrix Z_diff = pred.Zsig_.colwise() - pred.z_pred_;
+        NormalizeAngles<M::kAngles>(Z_diff);
+        pred.S_.noalias() = Z_diff * weights_.asDiagonal() * Z_diff.transpose();
+        pred.S_ += model.R_;
+    }
+
+    /**
+     * UpdateState Updates the state with the latest predicted measurement of model I
+     * @param z The measurement at k+1
+     * @param log_det_S If not NULL, receives log |S| from the Cholesky factor of S
+     * @return NIS of the measurement, computed from the Cholesky factor of S
+     */
+    template <int I>
+    double UpdateState(const typename PredictionType<I>::type::Vector &z, double *log_det_S = NULL) {
+        typedef typename ModelType<I>::type M;
+        typedef typename PredictionType<I>::type P;
+        typedef Eigen::Matrix<double, kStateDim, int(P::kDim)> CrossMatrix;
+        const P& pred = predicted_measurement<I>();
+        ObservedStage stage(observer_, StageObserver::kUpdateState, I);
+
+        //calculate cross correlation matrix
+        typename P::SigmaMatrix Z_diff = pred.Zsig_.colwise() - pred.z_pred_;
+        NormalizeAngles<M::kAngles>(Z_diff);
+        StateSigmaMatrix X_diff = Xsig_pred_.colwise() - x_;
+        NormalizeAngles<ProcessModel::kAngles>(X_diff);
+        CrossMatrix Tc = X_diff * weights_.asDiagonal() * Z_diff.transpose();
+
+        //factorize S once, it is used for the Kalman gain and the NIS
+        Eigen::LLT<typename P::Matrix> S_llt(pred.S_);
+
+        //Kalman gain K = Tc * S^-1
+        CrossMatrix K = S_llt.solve(Tc.transpose()).transpose();
+
+        //residual
+        typename P::Vector z_diff = z - pred.z_pred_;
+        NormalizeAngles<M::kAngles>(z_diff);
+
+        //update state mean and covariance matrix
+        x_ += K * z_diff;
+        P_ -= K * pred.S_ * K.transpose();
+        sigma_valid_ = false;
+
+        if (log_det_S != NULL) {
+            *log_det_S = LogDeterminant(S_llt);
+        }
+
+        //NIS = z_diff^T * S^-1 * z_diff = |L^-1 * z_diff|^2
+        return S_llt.matrixL().solve(z_diff).squaredNorm();
+    }
+
+    /**
+     * UpdateLinear Updates the state with a linear measurement model I using the
+     * closed-form Kalman update on x_ and P_, no sigma points are transformed
+     * @param z The measurement at k+1
+     * @param log_det_S If not NULL, receives log |S| from the Cholesky factor of S
+     * @return NIS of the measurement
+     */
+    template <int I>
+    double UpdateLinear(const typename PredictionType<I>::type::Vector &z, double *log_det_S = NULL) {
+        typedef typename ModelType<I>::type M;
+        typedef typename PredictionType<I>::type P;
+        typedef Eigen::Matrix<double, int(P::kDim), kStateDim> MeasurementMatrix;
+        typedef Eigen::Matrix<double, kStateDim, int(P::kDim)> CrossMatrix;
+        const M& model = measurement_model<I>();
+        P& pred = predicted_measurement<I>();
+        ObservedStage stage(observer_, StageObserver::kUpdateLinear, I);
+
+        const MeasurementMatrix H = model.template H<kStateDim>();
+        CrossMatrix PHt = P_ * H.transpose();
+
+        pred.z_pred_.noalias() = H * x_;
+        pred.S_.noalias() = H * PHt;
+        pred.S_ += model.R_;
+
+        //Kalman gain K = P * H^T * S^-1
+        Eigen::LLT<typename P::Matrix> S_llt(pred.S_);
+        CrossMatrix K = S_llt.solve(PHt.transpose()).transpose();
+
+        //residual
+        typename P::Vector z_diff = z - pred.z_pred_;
+        NormalizeAngles<M::kAngles>(z_diff);
+
+        //update state mean and covariance matrix
+        x_ += K * z_diff;
+        P_ -= K * PHt.transpose();
+        sigma_valid_ = false;
+
+        if (log_det_S != NULL) {
+            *log_det_S = LogDeterminant(S_llt);
+        }
+
+        return S_llt.matrixL().solve(z_diff).squaredNorm();
+    }
+
+    /**
+     * Update Predicts measurement I and updates the state with z
+     * @param log_det_S If not NULL, receives log |S|
+     * @return NIS of the measurement
+     */
+    template <int I>
+    double Update(const typename PredictionType<I>::type::Vector &z, double *log_det_S = NULL) {
+        PredictMeasurement<I>();
+        return UpdateState<I>(z, log_det_S);
+    }
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+protected:
+    // log |S| = 2 * sum log diag(L)
+    template <class LLT>
+    static double LogDeterminant(const LLT &S_llt) {
+        return 2.0 * S_llt.matrixLLT().diagonal().array().log().sum();
+    }
+
+    // process step from augmented sigma points, steps of max_step / 2 while
+    // longer than max_step; the state rows of Xsig_aug are moved along
+    void PredictFrom(AugmentedSigmaMatrix *Xsig_aug, double delta_t, double max_step) {
+        {
+            ObservedStage stage(observer_, StageObserver::kSigmaPointPrediction);
+            for (; delta_t > max_step; delta_t -= 0.5 * max_step) {
+                SigmaPointPrediction(*Xsig_aug, 0.5 * max_step);
+                Xsig_aug->template topRows<kStateDim>() = Xsig_pred_;
+            }
+            SigmaPointPrediction(*Xsig_aug, delta_t);
+        }
+        CompletePrediction();
+    }
+
+    // sigma points in whitened coordinates, state and noise rows
+    StateSigmaMatrix U_state_;
+    NoiseSigmaMatrix U_noise_;
+
+    // process noise standard deviations and the noise rows of the sigma points
+    NoiseVector process_noise_std_;
+    NoiseSigmaMatrix noise_sigma_;
+
+    ProcessModel process_;
+
+    std::tuple<MeasurementModels...> models_;
+
+    std::tuple<MeasurementPrediction<MeasurementModels>...> predictions_;
+
+    // Xsig_pred_ matches x_ and P_, cleared by every update
+    bool sigma_valid_;
+
+    // optional, not owned
+    StageObserver *observer_;
+};
+
+#endif /* UNSCENTED_FILTER_H_ */
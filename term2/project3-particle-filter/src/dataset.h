@@ -0,0 +1,301 @@
+/*
+ * dataset.h
+ * Packed binary form of the map, control, ground truth and observation data.
+ */
+
+#ifndef DATASET_H_
+#define DATASET_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "helper_functions.h"
+
+/*
+ * Layout of a dataset file, all in native byte order:
+ *
+ *   DatasetHeader
+ *   DatasetLandmark[num_landmarks]
+ *   control_s[num_steps]
+ *   ground_truth[num_steps]
+ *   uint64_t[num_steps + 1]          observations of step i are [index[i], index[i + 1])
+ *   DatasetObservation[num_observations]
+ *
+ * Every section starts at the offset given in the header, aligned to 8 bytes,
+ * so a mapped file is read in place without parsing.
+ */
+struct DatasetHeader {
+
+	char magic[8];					// "PFDATA" plus format version
+	uint32_t num_landmarks;
+	uint32_t num_steps;
+	uint64_t num_observations;
+	uint64_t landmarks_offset;		// Byte offsets of the sections from the start of the file
+	uint64_t controls_offset;
+	uint64_t ground_truth_offset;
+	uint64_t index_offset;
+	uint64_t observations_offset;
+	uint64_t file_size;
+};
+
+struct DatasetLandmark {
+
+	int32_t id;
+	float x;
+	float y;
+};
+
+struct DatasetObservation {
+
+	double x;
+	double y;
+};
+
+const char kDatasetMagic[8] = {'P', 'F', 'D', 'A', 'T', 'A', '0', '1'};
+
+/* Writes a dataset file.
+ * @param filename Name of the file to write
+ * @param map Map with the landmarks
+ * @param controls Control measurements, one per step
+ * @param gt Ground truth, one per step
+ * @param observations Observations of each step, as many as controls
+ * @output True if writing the file was successful
+ */
+inline bool write_dataset(std::string filename, const Map& map, const std::vector<control_s>& controls,
+		const std::vector<ground_truth>& gt, const std::vector<std::vector<LandmarkObs> >& observations) {
+
+	if (gt.size() != controls.size() || observations.size() != controls.size()) {
+		return false;
+	}
+
+	DatasetHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kDatasetMagic, sizeof(header.magic));
+	header.num_landmarks = map.landmark_list.size();
+	header.num_steps = controls.size();
+
+	std::vector<uint64_t> index(controls.size() + 1, 0);
+	for (int i = 0; i < observations.size(); i++) {
+		index[i + 1] = index[i] + observations[i].size();
+	}
+	header.num_observations = index.back();
+
+	// sizes are multiples of 4 or 8 bytes, round up to keep the doubles aligned
+	uint64_t offset = sizeof(DatasetHeader);
+	header.landmarks_offset = offset;
+	offset += (header.num_landmarks * sizeof(DatasetLandmark) + 7) & ~(uint64_t)7;
+	header.controls_offset = offset;
+	offset += header.num_steps * sizeof(control_s);
+	header.ground_truth_offset = offset;
+	offset += header.num_steps * sizeof(ground_truth);
+	header.index_offset = offset;
+	offset += index.size() * sizeof(uint64_t);
+	header.observations_offset = offset;
+	offset += header.num_observations * sizeof(DatasetObservation);
+	header.file_size = offset;
+
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out) {
+		return false;
+	}
+	out.write((const char*)&header, sizeof(header));
+
+	std::vector<DatasetLandmark> landmarks(header.num_landmarks);
+	for (int i = 0; i < landmarks.size(); i++) {
+		landmarks[i].id = map.landmark_list[i].id_i;
+		landmarks[i].x = map.landmark_list[i].x_f;
+		landmarks[i].y = map.landmark_list[i].y_f;
+	}
+	out.write((const char*)landmarks.data(), landmarks.size() * sizeof(DatasetLandmark));
+	const char padding[8] = {0};
+	out.write(padding, header.controls_offset - header.landmarks_offset - landmarks.size() * sizeof(DatasetLandmark));
+
+	out.write((const char*)controls.data(), controls.size() * sizeof(control_s));
+	out.write((const char*)gt.data(), gt.size() * sizeof(ground_truth));
+	out.write((const char*)index.data(), index.size() * sizeof(uint64_t));
+	for (int i = 0; i < observations.size(); i++) {
+		for (int j = 0; j < observations[i].size(); j++) {
+			DatasetObservation obs;
+			obs.x = observations[i][j].x;
+			obs.y = observations[i][j].y;
+			out.write((const char*)&obs, sizeof(obs));
+		}
+	}
+	return (bool)out;
+}
+
+/*
+ * Read-only memory mapping of a dataset file. The sections are used in
+ * place; observations of a step are copied out on request.
+ */
+class MappedDataset {
+public:
+
+	MappedDataset() : data(NULL), size(0), header(NULL) {}
+
+	~MappedDataset() {
+		close();
+	}
+
+	/**
+	 * open Maps a dataset file and checks its header.
+	 * @param filename Name of the file written by write_dataset
+	 * @output True if the file is a valid dataset
+	 */
+	bool open(std::string filename) {
+		close();
+
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(DatasetHeader)) {
+			::close(fd);
+			return false;
+		}
+		void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (mapped == MAP_FAILED) {
+			return false;
+		}
+		data = (const char*)mapped;
+		size = st.st_size;
+		header = (const DatasetHeader*)data;
+
+		if (!valid()) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * close Unmaps the file.
+	 */
+	void close() {
+		if (data != NULL) {
+			munmap((void*)data, size);
+		}
+		data = NULL;
+		size = 0;
+		header = NULL;
+	}
+
+	/**
+	 * isOpen Returns whether a dataset is mapped.
+	 */
+	bool isOpen() const {
+		return data != NULL;
+	}
+
+	/**
+	 * steps Number of time steps.
+	 */
+	int steps() const {
+		return header->num_steps;
+	}
+
+	/**
+	 * controls Control measurements of all steps, in place.
+	 */
+	const control_s* controls() const {
+		return (const control_s*)(data + header->controls_offset);
+	}
+
+	/**
+	 * groundTruth Ground truth of all steps, in place.
+	 */
+	const ground_truth* groundTruth() const {
+		return (const ground_truth*)(data + header->ground_truth_offset);
+	}
+
+	/**
+	 * readMap Fills the map with the landmarks and indexes them.
+	 */
+	void readMap(Map& map) const {
+		const DatasetLandmark* landmarks = (const DatasetLandmark*)(data + header->landmarks_offset);
+		map.landmark_list.resize(header->num_landmarks);
+		for (int i = 0; i < header->num_landmarks; i++) {
+			map.landmark_list[i].id_i = landmarks[i].id;
+			map.landmark_list[i].x_f = landmarks[i].x;
+			map.landmark_list[i].y_f = landmarks[i].y;
+		}
+		map.buildIndex();
+	}
+
+	/**
+	 * readObservations Replaces observations with the ones of a step.
+	 * @param step Time step, 0 based
+	 */
+	void readObservations(int step, std::vector<LandmarkObs>& observations) const {
+		const uint64_t begin = index()[step];
+		const uint64_t end = index()[step + 1];
+		const DatasetObservation* records = (const DatasetObservation*)(data + header->observations_offset);
+
+		observations.resize(end - begin);
+		for (uint64_t j = begin; j < end; j++) {
+			observations[j - begin].id = -1;
+			observations[j - begin].x = records[j].x;
+			observations[j - begin].y = records[j].y;
+		}
+	}
+
+private:
+
+	// the mapping is owned, no copies
+	MappedDataset(const MappedDataset&);
+	MappedDataset& operator=(const MappedDataset&);
+
+	const uint64_t* index() const {
+		return (const uint64_t*)(data + header->index_offset);
+	}
+
+	/**
+	 * fits Returns whether count records of record_size bytes at offset lie within the file
+	 *   and are aligned for them, without overflowing.
+	 */
+	bool fits(uint64_t offset, uint64_t count, uint64_t record_size, uint64_t alignment) const {
+		return offset <= size && offset % alignment == 0 && count <= (size - offset) / record_size;
+	}
+
+	/**
+	 * valid Checks the header of a mapped file: magic, size, every section within the
+	 *   file, and an observation index that starts at 0, never decreases and ends at
+	 *   num_observations.
+	 */
+	bool valid() const {
+		if (memcmp(header->magic, kDatasetMagic, sizeof(kDatasetMagic)) != 0 || header->file_size != size
+				|| header->num_steps == UINT32_MAX
+				|| !fits(header->landmarks_offset, header->num_landmarks, sizeof(DatasetLandmark), 4)
+				|| !fits(header->controls_offset, header->num_steps, sizeof(control_s), 8)
+				|| !fits(header->ground_truth_offset, header->num_steps, sizeof(ground_truth), 8)
+				|| !fits(header->index_offset, header->num_steps + 1, sizeof(uint64_t), 8)
+				|| !fits(header->observations_offset, header->num_observations, sizeof(DatasetObservation), 8)) {
+			return false;
+		}
+
+		const uint64_t* steps = index();
+		if (steps[0] != 0 || steps[header->num_steps] != header->num_observations) {
+			return false;
+		}
+		for (uint32_t i = 0; i < header->num_steps; i++) {
+			if (steps[i + 1] < steps[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	const char* data;
+	size_t size;
+	const DatasetHeader* header;
+};
+
+#endif /* DATASET_H_ */
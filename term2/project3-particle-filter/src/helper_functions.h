@@ -102,6 +102,9 @@ inline bool read_map_data(std::string filename, Map& map) {
 		// Add to landmark list of map:
 		map.landmark_list.push_back(single_landmark_temp);
 	}
+
+	// Index the landmarks for range queries
+	map.buildIndex();
 	return true;
 }
 
@@ -0,0 +1,139 @@
+/*
+ * kd_tree.h
+ * Static 2-D k-d tree for nearest neighbor data association.
+ */
+
+#ifndef KD_TREE_H_
+#define KD_TREE_H_
+
+#include <algorithm>
+#include <vector>
+#include "helper_functions.h"
+
+/*
+ * Balanced k-d tree stored implicitly in one array: the node of the range
+ * [begin, end) is its median (begin + end) / 2, which splits on x at even
+ * and on y at odd depths. Rebuilding reuses the storage, so a tree kept
+ * across calls stops allocating once it has seen its largest input.
+ */
+class KdTree2D {
+public:
+
+	/**
+	 * build Builds the tree over the points.
+	 * @param points Points to search, e.g. the landmarks in sensor range
+	 */
+	void build(const std::vector<LandmarkObs>& points) {
+		nodes.resize(points.size());
+		for (int i = 0; i < points.size(); i++) {
+			nodes[i].x = points[i].x;
+			nodes[i].y = points[i].y;
+			nodes[i].index = i;
+		}
+		build(0, nodes.size(), 0);
+	}
+
+	/**
+	 * reserve Allocates the nodes for up to n points, so builds up to that size do not allocate.
+	 */
+	void reserve(int n) {
+		nodes.reserve(n);
+	}
+
+	/**
+	 * nearest Finds the point closest to (x, y).
+	 * @param dist2 Squared distance to the nearest point, if not NULL
+	 * @output Index of the nearest point in the build input, -1 if the tree is empty
+	 */
+	int nearest(double x, double y, double* dist2 = NULL) const {
+		int best = -1;
+		double best_dist2 = 1e300;
+		if (!nodes.empty()) {
+			nearest(0, nodes.size(), 0, x, y, best, best_dist2);
+		}
+		if (dist2 != NULL) {
+			*dist2 = best_dist2;
+		}
+		return best;
+	}
+
+	/**
+	 * size Number of points in the tree.
+	 */
+	int size() const {
+		return nodes.size();
+	}
+
+	/**
+	 * memoryUsage Bytes of the node buffer.
+	 */
+	size_t memoryUsage() const {
+		return nodes.capacity() * sizeof(Node);
+	}
+
+private:
+
+	struct Node {
+		double x;
+		double y;
+		int index;
+	};
+
+	struct LessX {
+		bool operator()(const Node& a, const Node& b) const { return a.x < b.x; }
+	};
+
+	struct LessY {
+		bool operator()(const Node& a, const Node& b) const { return a.y < b.y; }
+	};
+
+	void build(int begin, int end, int depth) {
+		if (end - begin < 2) {
+			return;
+		}
+		int mid = (begin + end) / 2;
+		if (depth % 2 == 0) {
+			std::nth_element(nodes.begin() + begin, nodes.begin() + mid, nodes.begin() + end, LessX());
+		}
+		else {
+			std::nth_element(nodes.begin() + begin, nodes.begin() + mid, nodes.begin() + end, LessY());
+		}
+		build(begin, mid, depth + 1);
+		build(mid + 1, end, depth + 1);
+	}
+
+	void nearest(int begin, int end, int depth, double x, double y, int& best, double& best_dist2) const {
+		if (begin >= end) {
+			return;
+		}
+		int mid = (begin + end) / 2;
+		const Node& node = nodes[mid];
+
+		double dx = node.x - x;
+		double dy = node.y - y;
+		double d2 = dx * dx + dy * dy;
+		if (d2 < best_dist2) {
+			best_dist2 = d2;
+			best = node.index;
+		}
+
+		// search the side of the query first, the other side only if the split is closer than the best
+		double split = depth % 2 == 0 ? x - node.x : y - node.y;
+		if (split < 0) {
+			nearest(begin, mid, depth + 1, x, y, best, best_dist2);
+			if (split * split < best_dist2) {
+				nearest(mid + 1, end, depth + 1, x, y, best, best_dist2);
+			}
+		}
+		else {
+			nearest(mid + 1, end, depth + 1, x, y, best, best_dist2);
+			if (split * split < best_dist2) {
+				nearest(begin, mid, depth + 1, x, y, best, best_dist2);
+			}
+		}
+	}
+
+	std::vector<Node> nodes;
+};
+
+#endif /* KD_TREE_H_ */
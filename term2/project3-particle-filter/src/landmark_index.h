@@ -0,0 +1,216 @@
+/*
+ * landmark_index.h
+ * Uniform grid index over map landmarks for sensor range queries.
+ */
+
+#ifndef LANDMARK_INDEX_H_
+#define LANDMARK_INDEX_H_
+
+#include <math.h>
+#include <vector>
+
+/*
+ * Landmarks sorted into square cells, stored compactly: the landmarks of cell c
+ * are entries cell_start[c] to cell_start[c + 1] - 1 of the cell ordered arrays.
+ * A range query visits the cells overlapping the query square, so with cells
+ * sized to the landmark density its cost is proportional to the result size.
+ */
+class LandmarkIndex {
+public:
+
+	LandmarkIndex() : min_x(0), min_y(0), cell_size(1), num_x(0), num_y(0) {}
+
+	/**
+	 * build Sorts the landmarks into cells.
+	 * @param landmarks Landmarks with x_f and y_f positions, e.g. Map::landmark_list
+	 * @param size Cell edge length [m], 0 picks about two landmarks per cell
+	 */
+	template <typename Landmark>
+	void build(const std::vector<Landmark>& landmarks, double size = 0) {
+		build(landmarks.data(), landmarks.size(), size);
+	}
+
+	/**
+	 * build Sorts the landmarks of an array into cells, e.g. a tile of a mapped file.
+	 * @param landmarks Array of n landmarks with x_f and y_f positions
+	 * @param size Cell edge length [m], 0 picks about two landmarks per cell
+	 */
+	template <typename Landmark>
+	void build(const Landmark* landmarks, int n, double size = 0) {
+		cell_start.clear();
+		cell_x.clear();
+		cell_y.clear();
+		cell_landmark.clear();
+		num_x = num_y = 0;
+		if (n == 0) {
+			return;
+		}
+
+		// bounding box
+		double max_x, max_y;
+		min_x = max_x = landmarks[0].x_f;
+		min_y = max_y = landmarks[0].y_f;
+		for (int i = 1; i < n; i++) {
+			min_x = fmin(min_x, landmarks[i].x_f);
+			max_x = fmax(max_x, landmarks[i].x_f);
+			min_y = fmin(min_y, landmarks[i].y_f);
+			max_y = fmax(max_y, landmarks[i].y_f);
+		}
+
+		if (size <= 0) {
+			double area = fmax(max_x - min_x, 1.0) * fmax(max_y - min_y, 1.0);
+			size = sqrt(2.0 * area / n);
+		}
+		cell_size = size;
+		num_x = (int)((max_x - min_x) / cell_size) + 1;
+		num_y = (int)((max_y - min_y) / cell_size) + 1;
+
+		// counting sort by cell
+		std::vector<int> cells(n);
+		cell_start.assign(num_x * num_y + 1, 0);
+		for (int i = 0; i < n; i++) {
+			cells[i] = cellX(landmarks[i].x_f) + num_x * cellY(landmarks[i].y_f);
+			cell_start[cells[i] + 1]++;
+		}
+		for (int c = 0; c < num_x * num_y; c++) {
+			cell_start[c + 1] += cell_start[c];
+		}
+
+		std::vector<int> next(cell_start.begin(), cell_start.end() - 1);
+		cell_x.resize(n);
+		cell_y.resize(n);
+		cell_landmark.resize(n);
+		for (int i = 0; i < n; i++) {
+			int k = next[cells[i]]++;
+			cell_x[k] = landmarks[i].x_f;
+			cell_y[k] = landmarks[i].y_f;
+			cell_landmark[k] = i;
+		}
+	}
+
+	/**
+	 * forEachInRange Calls visit(index, x, y) for every landmark within range of (x, y),
+	 *   index is the position in the landmark list the index was built from.
+	 */
+	template <typename Visitor>
+	void forEachInRange(double x, double y, double range, Visitor visit) const {
+		if (num_x == 0) {
+			return;
+		}
+		int x0 = cellX(x - range), x1 = cellX(x + range);
+		int y0 = cellY(y - range), y1 = cellY(y + range);
+		double range2 = range * range;
+
+		for (int cy = y0; cy <= y1; cy++) {
+			// the landmarks of a row of cells are contiguous
+			int begin = cell_start[x0 + num_x * cy];
+			int end = cell_start[x1 + 1 + num_x * cy];
+			for (int k = begin; k < end; k++) {
+				double dx = cell_x[k] - x;
+				double dy = cell_y[k] - y;
+				if (dx * dx + dy * dy <= range2) {
+					visit(cell_landmark[k], cell_x[k], cell_y[k]);
+				}
+			}
+		}
+	}
+
+	/**
+	 * query Collects the list indices of the landmarks within range of (x, y).
+	 */
+	void query(double x, double y, double range, std::vector<int>& result) const {
+		result.clear();
+		forEachInRange(x, y, range, AppendIndex(result));
+	}
+
+	/**
+	 * maxInRange Upper bound of the number of landmarks forEachInRange visits for any
+	 *   query point: the most landmarks in any block of the cells a query square can overlap.
+	 */
+	int maxInRange(double range) const {
+		if (num_x == 0) {
+			return 0;
+		}
+		// a square of side 2 range overlaps at most 2 range / cell_size + 2 cells per axis
+		const double span = 2.0 * range / cell_size + 2.0;
+		const int wx = span < num_x ? (int)span : num_x;
+		const int wy = span < num_y ? (int)span : num_y;
+
+		// landmarks of the cells below and left of each grid corner
+		const int stride = num_x + 1;
+		std::vector<int> sums(stride * (num_y + 1), 0);
+		for (int cy = 0; cy < num_y; cy++) {
+			for (int cx = 0; cx < num_x; cx++) {
+				const int c = cx + num_x * cy;
+				sums[cx + 1 + stride * (cy + 1)] = cell_start[c + 1] - cell_start[c]
+						+ sums[cx + 1 + stride * cy] + sums[cx + stride * (cy + 1)] - sums[cx + stride * cy];
+			}
+		}
+
+		int most = 0;
+		for (int y0 = 0; y0 + wy <= num_y; y0++) {
+			for (int x0 = 0; x0 + wx <= num_x; x0++) {
+				const int count = sums[x0 + wx + stride * (y0 + wy)] - sums[x0 + stride * (y0 + wy)]
+						- sums[x0 + wx + stride * y0] + sums[x0 + stride * y0];
+				most = count > most ? count : most;
+			}
+		}
+		return most;
+	}
+
+	/**
+	 * size Number of indexed landmarks.
+	 */
+	int size() const {
+		return cell_landmark.size();
+	}
+
+	/**
+	 * empty Returns whether no landmarks are indexed.
+	 */
+	bool empty() const {
+		return num_x == 0;
+	}
+
+	/**
+	 * memoryUsage Bytes of the cell buffers.
+	 */
+	size_t memoryUsage() const {
+		return (cell_start.capacity() + cell_landmark.capacity()) * sizeof(int)
+				+ (cell_x.capacity() + cell_y.capacity()) * sizeof(float);
+	}
+
+private:
+
+	struct AppendIndex {
+		std::vector<int>& result;
+		explicit AppendIndex(std::vector<int>& r) : result(r) {}
+		void operator()(int index, float, float) const {
+			result.push_back(index);
+		}
+	};
+
+	// cell coordinates, clamped to the grid
+	int cellX(double x) const {
+		double c = floor((x - min_x) / cell_size);
+		return c < 0 ? 0 : (c >= num_x ? num_x - 1 : (int)c);
+	}
+
+	int cellY(double y) const {
+		double c = floor((y - min_y) / cell_size);
+		return c < 0 ? 0 : (c >= num_y ? num_y - 1 : (int)c);
+	}
+
+	double min_x;
+	double min_y;
+	double cell_size;
+	int num_x;
+	int num_y;
+
+	std::vector<int> cell_start;
+	std::vector<float> cell_x;
+	std::vector<float> cell_y;
+	std::vector<int> cell_landmark;
+};
+
+#endif /* LANDMARK_INDEX_H_ */
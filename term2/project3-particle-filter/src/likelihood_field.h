@@ -0,0 +1,240 @@
+/*
+ * likelihood_field.h
+ * Raster of observation log likelihoods over the map.
+ */
+
+#ifndef LIKELIHOOD_FIELD_H_
+#define LIKELIHOOD_FIELD_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "helper_functions.h"
+#include "kd_tree.h"
+
+/*
+ * Log likelihood of an observation at each point of a grid over the map:
+ * the bivariate Gaussian of the offset to the nearest landmark, the same
+ * nearest neighbor match dataAssociation makes. Weighting an observation is
+ * then a transform to map coordinates and a bilinear lookup.
+ *
+ * The grid covers the landmarks plus a margin, points outside are clamped to
+ * the border. Building takes one nearest neighbor search per grid point, so
+ * the raster can be saved and loaded again for the same map and parameters.
+ */
+class LikelihoodField {
+public:
+
+	LikelihoodField() : resolution(0), std_x(0), std_y(0), margin(0), origin_x(0), origin_y(0), width(0), height(0),
+			fingerprint(0) {}
+
+	/**
+	 * build Rasterizes the field of the map.
+	 * @param map Map with the landmarks
+	 * @param std_x, std_y Standard deviations of the observations [m]
+	 * @param resolution Grid spacing [m]
+	 * @param margin Extent of the grid beyond the landmarks [m], e.g. the sensor range
+	 */
+	void build(const Map& map, double std_x_in, double std_y_in, double resolution_in, double margin_in) {
+		resolution = resolution_in;
+		std_x = std_x_in;
+		std_y = std_y_in;
+		margin = margin_in;
+		fingerprint = mapFingerprint(map);
+
+		const std::vector<Map::single_landmark_s>& landmarks = map.landmark_list;
+		if (landmarks.empty() || resolution <= 0) {
+			width = height = 0;
+			values.clear();
+			return;
+		}
+
+		double min_x = landmarks[0].x_f, max_x = landmarks[0].x_f;
+		double min_y = landmarks[0].y_f, max_y = landmarks[0].y_f;
+		std::vector<LandmarkObs> points(landmarks.size());
+		for (int i = 0; i < landmarks.size(); i++) {
+			points[i].id = landmarks[i].id_i;
+			points[i].x = landmarks[i].x_f;
+			points[i].y = landmarks[i].y_f;
+			min_x = std::min(min_x, points[i].x);
+			max_x = std::max(max_x, points[i].x);
+			min_y = std::min(min_y, points[i].y);
+			max_y = std::max(max_y, points[i].y);
+		}
+		origin_x = min_x - margin;
+		origin_y = min_y - margin;
+		width = (int)ceil((max_x + margin - origin_x) / resolution) + 1;
+		height = (int)ceil((max_y + margin - origin_y) / resolution) + 1;
+
+		KdTree2D tree;
+		tree.build(points);
+
+		// log p = -log(2 pi sx sy) - 0.5 dx^2 / sx^2 - 0.5 dy^2 / sy^2
+		const double log_norm = -log(2.0 * M_PI * std_x * std_y);
+		const double cx = -0.5 / (std_x * std_x);
+		const double cy = -0.5 / (std_y * std_y);
+
+		values.resize((size_t)width * height);
+		for (int row = 0; row < height; row++) {
+			const double y = origin_y + row * resolution;
+			for (int col = 0; col < width; col++) {
+				const double x = origin_x + col * resolution;
+				const LandmarkObs& nearest = points[tree.nearest(x, y)];
+				const double dx = x - nearest.x;
+				const double dy = y - nearest.y;
+				values[(size_t)row * width + col] = (float)(log_norm + cx * dx * dx + cy * dy * dy);
+			}
+		}
+	}
+
+	/**
+	 * matches Returns whether the field was built for the map and parameters.
+	 */
+	bool matches(const Map& map, double std_x_in, double std_y_in, double resolution_in, double margin_in) const {
+		return !empty() && resolution == resolution_in && std_x == std_x_in && std_y == std_y_in
+				&& margin == margin_in && fingerprint == mapFingerprint(map);
+	}
+
+	/**
+	 * save Writes the field to a binary file.
+	 * @output True on success
+	 */
+	bool save(const std::string& filename) const {
+		std::ofstream out(filename.c_str(), std::ios::binary);
+		if (!out) {
+			return false;
+		}
+		out.write(magic(), 8);
+		out.write((const char*)&resolution, sizeof(resolution));
+		out.write((const char*)&std_x, sizeof(std_x));
+		out.write((const char*)&std_y, sizeof(std_y));
+		out.write((const char*)&margin, sizeof(margin));
+		out.write((const char*)&origin_x, sizeof(origin_x));
+		out.write((const char*)&origin_y, sizeof(origin_y));
+		out.write((const char*)&width, sizeof(width));
+		out.write((const char*)&height, sizeof(height));
+		out.write((const char*)&fingerprint, sizeof(fingerprint));
+		out.write((const char*)values.data(), values.size() * sizeof(float));
+		return (bool)out;
+	}
+
+	/**
+	 * load Reads a field written by save.
+	 * @output True on success, false leaves the field empty, also when the grid size in the
+	 *   header does not match the size of the file
+	 */
+	bool load(const std::string& filename) {
+		std::ifstream in(filename.c_str(), std::ios::binary | std::ios::ate);
+		const std::streamoff file_size = in.tellg();
+		in.seekg(0);
+		char header[8];
+		if (!in.read(header, sizeof(header)) || memcmp(header, magic(), sizeof(header)) != 0) {
+			return false;
+		}
+		in.read((char*)&resolution, sizeof(resolution));
+		in.read((char*)&std_x, sizeof(std_x));
+		in.read((char*)&std_y, sizeof(std_y));
+		in.read((char*)&margin, sizeof(margin));
+		in.read((char*)&origin_x, sizeof(origin_x));
+		in.read((char*)&origin_y, sizeof(origin_y));
+		in.read((char*)&width, sizeof(width));
+		in.read((char*)&height, sizeof(height));
+		in.read((char*)&fingerprint, sizeof(fingerprint));
+		// the values fill the rest of the file exactly
+		if (!in || width < 0 || height < 0
+				|| (uint64_t)width * (uint64_t)height * sizeof(float) != (uint64_t)(file_size - in.tellg())) {
+			width = height = 0;
+			values.clear();
+			return false;
+		}
+		values.resize((size_t)width * height);
+		if (!in.read((char*)values.data(), values.size() * sizeof(float))) {
+			width = height = 0;
+			values.clear();
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * logLikelihood Log likelihood of an observation at (x, y) in map coordinates,
+	 *   interpolated between the four surrounding grid points. The field must not be empty.
+	 */
+	double logLikelihood(double x, double y) const {
+		// clamp into the grid, the last row and column only as the far corner
+		const double gx = std::min(std::max((x - origin_x) / resolution, 0.0), width - 1.000001);
+		const double gy = std::min(std::max((y - origin_y) / resolution, 0.0), height - 1.000001);
+		const int col = (int)gx;
+		const int row = (int)gy;
+		const double fx = gx - col;
+		const double fy = gy - row;
+
+		const float* v = &values[(size_t)row * width + col];
+		const double bottom = v[0] + fx * (v[1] - v[0]);
+		const double top = v[width] + fx * (v[width + 1] - v[width]);
+		return bottom + fy * (top - bottom);
+	}
+
+	/**
+	 * empty Returns whether the field has not been built or loaded, or is smaller than the
+	 *   2 x 2 grid points an interpolation needs (no landmarks, resolution <= 0).
+	 */
+	bool empty() const {
+		return width < 2 || height < 2;
+	}
+
+	/**
+	 * memoryUsage Bytes of the raster.
+	 */
+	size_t memoryUsage() const {
+		return values.capacity() * sizeof(float);
+	}
+
+private:
+
+	// First bytes of a saved field, the last one is the format version
+	static const char* magic() {
+		return "PFFIELD1";
+	}
+
+	/**
+	 * mapFingerprint FNV-1a hash of the landmark ids and positions.
+	 */
+	static uint64_t mapFingerprint(const Map& map) {
+		uint64_t hash = 0xCBF29CE484222325ull;
+		for (int i = 0; i < map.landmark_list.size(); i++) {
+			const Map::single_landmark_s& landmark = map.landmark_list[i];
+			unsigned char bytes[12];
+			memcpy(bytes, &landmark.id_i, 4);
+			memcpy(bytes + 4, &landmark.x_f, 4);
+			memcpy(bytes + 8, &landmark.y_f, 4);
+			for (int j = 0; j < 12; j++) {
+				hash = (hash ^ bytes[j]) * 0x100000001B3ull;
+			}
+		}
+		return hash;
+	}
+
+	double resolution;
+	double std_x;
+	double std_y;
+	double margin;
+
+	// Map coordinates of grid point (0, 0)
+	double origin_x;
+	double origin_y;
+
+	// Grid points per row and number of rows
+	int width;
+	int height;
+
+	uint64_t fingerprint;
+
+	// Log likelihoods, row major from origin_y up
+	std::vector<float> values;
+};
+
+#endif /* LIKELIHOOD_FIELD_H_ */
@@ -9,15 +9,18 @@
 #include <ctime>
 #include <iomanip>
 #include <random>
+#include <thread>
 
 #include "particle_filter.h"
 #include "helper_functions.h"
+#include "dataset.h"
+#include "tiled_map.h"
 
 using namespace std;
 
 
 
-int main() {
+int main(int argc, char* argv[]) {
 	
 	// parameters related to grading.
 	int time_steps_before_lock_required = 100; // number of time steps before accuracy is checked by grader.
@@ -50,42 +53,86 @@ int main() {
 	normal_distribution<double> N_obs_x(0, sigma_landmark[0]);
 	normal_distribution<double> N_obs_y(0, sigma_landmark[1]);
 	double n_x, n_y, n_theta, n_range, n_heading;
-	// Read map data
-	Map map;
-	if (!read_map_data("data/map_data.txt", map)) {
-		cout << "Error: Could not open map file" << endl;
-		return -1;
-	}
 
-	// Read position data
+	// "--likelihood-field" weights observations with a raster of the map, cached next to it
+	bool use_likelihood_field = argc > 1 && string(argv[1]) == "--likelihood-field";
+
+	// Otherwise take the landmarks from the tiled map written by pack_dataset if there is one,
+	// paged in around the particles instead of read whole
+	TiledMap tiled_map;
+	bool use_tiled_map = !use_likelihood_field && tiled_map.open("data/map_data.tiles", 16);
+
+	// Read all data from the packed dataset written by pack_dataset if there is one,
+	// otherwise from the text files
+	MappedDataset dataset;
+	Map map;
 	vector<control_s> position_meas;
-	if (!read_control_data("data/control_data.txt", position_meas)) {
-		cout << "Error: Could not open position/control measurement file" << endl;
-		return -1;
-	}
-	
-	// Read ground truth data
 	vector<ground_truth> gt;
-	if (!read_gt_data("data/gt_data.txt", gt)) {
-		cout << "Error: Could not open ground truth data file" << endl;
-		return -1;
+	if (dataset.open("data/dataset.bin")) {
+		if (!use_tiled_map) {
+			dataset.readMap(map);
+		}
+		position_meas.assign(dataset.controls(), dataset.controls() + dataset.steps());
+		gt.assign(dataset.groundTruth(), dataset.groundTruth() + dataset.steps());
+	}
+	else {
+		// Read map data
+		if (!use_tiled_map && !read_map_data("data/map_data.txt", map)) {
+			cout << "Error: Could not open map file" << endl;
+			return -1;
+		}
+
+		// Read position data
+		if (!read_control_data("data/control_data.txt", position_meas)) {
+			cout << "Error: Could not open position/control measurement file" << endl;
+			return -1;
+		}
+
+		// Read ground truth data
+		if (!read_gt_data("data/gt_data.txt", gt)) {
+			cout << "Error: Could not open ground truth data file" << endl;
+			return -1;
+		}
 	}
 	
 	// Run particle filter!
 	int num_time_steps = position_meas.size();
 	ParticleFilter pf;
+	pf.setNumThreads(std::thread::hardware_concurrency());
+	// adapt the number of particles with KLD-sampling
+	pf.setParticleLimits(20, 500);
+	// resample once the effective sample size drops below half the particles
+	pf.setResampleThreshold(0.5);
+
+	if (use_likelihood_field) {
+		bool loaded;
+		if (!pf.useLikelihoodField(map, sigma_landmark, 0.1, sensor_range, "data/map_data.field", &loaded)) {
+			cerr << "Cannot build a likelihood field of the map, associating instead" << endl;
+		}
+		else if (!loaded) {
+			cout << "Built likelihood field data/map_data.field" << endl;
+		}
+	}
 	double total_error[3] = {0,0,0};
 	double cum_mean_error[3] = {0,0,0};
+	// reused every time step
+	vector<LandmarkObs> observations;
+	vector<LandmarkObs> noisy_observations;
 	
 	for (int i = 0; i < num_time_steps; ++i) {
 		cout << "Time step: " << i << endl;
 		// Read in landmark observations for current time step.
-		ostringstream file;
-		file << "data/observation/observations_" << setfill('0') << setw(6) << i+1 << ".txt";
-		vector<LandmarkObs> observations;
-		if (!read_landmark_data(file.str(), observations)) {
-			cout << "Error: Could not open observation file " << i+1 << endl;
-			return -1;
+		observations.clear();
+		if (dataset.isOpen()) {
+			dataset.readObservations(i, observations);
+		}
+		else {
+			ostringstream file;
+			file << "data/observation/observations_" << setfill('0') << setw(6) << i+1 << ".txt";
+			if (!read_landmark_data(file.str(), observations)) {
+				cout << "Error: Could not open observation file " << i+1 << endl;
+				return -1;
+			}
 		}
 		
 		// Initialize particle filter if this is the first time step.
@@ -100,7 +147,7 @@ int main() {
 			pf.prediction(delta_t, sigma_pos, position_meas[i-1].velocity, position_meas[i-1].yawrate);
 		}
 		// simulate the addition of noise to noiseless observation data.
-		vector<LandmarkObs> noisy_observations;
+		noisy_observations.clear();
 		LandmarkObs obs;
 		for (int j = 0; j < observations.size(); ++j) {
 			n_x = N_obs_x(gen);
@@ -112,20 +159,17 @@ int main() {
 		}
 
 		// Update the weights and resample
-		pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, map);
+		if (use_tiled_map) {
+			pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, tiled_map);
+		}
+		else {
+			pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, map);
+		}
 		pf.resample();
 		
 		// Calculate and output the average weighted error of the particle filter over all time steps so far.
-		vector<Particle> particles = pf.particles;
-		int num_particles = particles.size();
-		double highest_weight = 0.0;
-		Particle best_particle;
-		for (int i = 0; i < num_particles; ++i) {
-			if (particles[i].weight > highest_weight) {
-				highest_weight = particles[i].weight;
-				best_particle = particles[i];
-			}
-		}
+		// The filter keeps its best particle from the weight update, resampling does not change it.
+		const Particle& best_particle = pf.bestParticle();
 		double *avg_error = getError(gt[i].x, gt[i].y, gt[i].theta, best_particle.x, best_particle.y, best_particle.theta);
 
 		for (int j = 0; j < 3; ++j) {
@@ -8,6 +8,9 @@
 #ifndef MAP_H_
 #define MAP_H_
 
+#include <vector>
+#include "landmark_index.h"
+
 class Map {
 public:
 	
@@ -20,6 +23,16 @@ public:
 
 	std::vector<single_landmark_s> landmark_list ; // List of landmarks in the map
 
+	LandmarkIndex index; // Spatial index over landmark_list, rebuild with buildIndex() after changing the list
+
+	/**
+	 * buildIndex Builds the spatial index over landmark_list.
+	 * @param cell_size Grid cell size [m], 0 picks it from the landmark density
+	 */
+	void buildIndex(double cell_size = 0) {
+		index.build(landmark_list, cell_size);
+	}
+
 };
 
 
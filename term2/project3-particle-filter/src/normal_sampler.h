@@ -0,0 +1,179 @@
+/*
+ * normal_sampler.h
+ * Gaussian noise from counter-based random streams.
+ */
+
+#ifndef NORMAL_SAMPLER_H_
+#define NORMAL_SAMPLER_H_
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "philox.h"
+
+/*
+ * Normal samples drawn in batches with the Box-Muller transform. Samples
+ * 4k..4k+3 of stream (a, b, c) come from Philox block (k, a, b, c) under the
+ * key, so the samples depend only on the stream and the position in it:
+ * chunks of particles can be filled in any order and on any thread, and the
+ * sampler holds no state besides the key.
+ *
+ * Each pair of words gives u in (0, 1) and v in [-1/2, 1/2), and the pair of
+ * samples sqrt(-2 log u) (cos 2 pi v, sin 2 pi v); 32 bit u cuts the tails
+ * at 6.8 standard deviations. log, sin and cos are branch-free polynomials
+ * (error below 1e-10) instead of libm calls, so the batch loop can run in
+ * SIMD lanes where the target has 32 bit multiplies with 64 bit products
+ * (SSE4.1, AVX2, NEON).
+ */
+class NormalSampler {
+public:
+
+	/**
+	 * Constructor
+	 * @param seed Key of all streams
+	 */
+	explicit NormalSampler(uint64_t seed = 0) {
+		setSeed(seed);
+	}
+
+	/**
+	 * setSeed Sets the key of all streams.
+	 */
+	void setSeed(uint64_t seed) {
+		key[0] = (uint32_t)seed;
+		key[1] = (uint32_t)(seed >> 32);
+	}
+
+	/**
+	 * add Adds stddev times the first n samples of stream (a, b, c) to values.
+	 * @param a, b, c Stream identifiers, e.g. purpose, time step and chunk
+	 * @param stddev Standard deviation of the noise
+	 * @param values Array of n values to add the noise to
+	 */
+	void add(uint32_t a, uint32_t b, uint32_t c, double stddev, double* values, int n) const {
+		double z[4][kBatch];
+
+		for (int begin = 0; begin < n; begin += 4 * kBatch) {
+			int blocks = (n - begin + 3) / 4;
+			if (blocks > kBatch) {
+				blocks = kBatch;
+			}
+			const uint32_t first_block = begin / 4;
+			const uint32_t k0 = key[0], k1 = key[1];
+
+#pragma omp simd
+			for (int k = 0; k < blocks; k++) {
+				uint32_t w0 = first_block + k, w1 = a, w2 = b, w3 = c;
+				Philox4x32::block(w0, w1, w2, w3, k0, k1);
+				boxMuller(w0, w1, stddev, z[0][k], z[1][k]);
+				boxMuller(w2, w3, stddev, z[2][k], z[3][k]);
+			}
+
+			// the last block contributes only the samples up to n
+			const int full = (n - begin) / 4 < blocks ? (n - begin) / 4 : blocks;
+			double* out = values + begin;
+#pragma omp simd
+			for (int k = 0; k < full; k++) {
+				out[4 * k] += z[0][k];
+				out[4 * k + 1] += z[1][k];
+				out[4 * k + 2] += z[2][k];
+				out[4 * k + 3] += z[3][k];
+			}
+			for (int j = 4 * full; j < n - begin && j < 4 * blocks; j++) {
+				out[j] += z[j % 4][full];
+			}
+		}
+	}
+
+	/**
+	 * sinCos sin and cos of an angle in radians, |angle| < 2^50. The angle is
+	 *   reduced to [-1/2, 1/2] turn by rounding with 1.5 * 2^52, so like the
+	 *   samples there is no libm call or branch and callers' loops can run in
+	 *   SIMD lanes.
+	 */
+	static void sinCos(double angle, double& sin_t, double& cos_t) {
+		const double turns = angle * (0.5 / M_PI);
+		const double rounded = (turns + 6755399441055744.0) - 6755399441055744.0;
+		sinCosTurn(turns - rounded, sin_t, cos_t);
+	}
+
+private:
+
+	// Blocks of 4 samples per batch, kept on the stack
+	static const int kBatch = 64;
+
+	// 2^-32, scales a 32 bit word into [0, 1)
+	static constexpr double kTwoToMinus32 = 1.0 / 4294967296.0;
+
+	/**
+	 * toDouble Unsigned word as double, through the signed conversion SIMD units have.
+	 */
+	static double toDouble(uint32_t x) {
+		return (double)(int32_t)(x ^ 0x80000000u) + 2147483648.0;
+	}
+
+	/**
+	 * boxMuller Pair of normal samples times stddev from two random words.
+	 */
+	static void boxMuller(uint32_t word_u, uint32_t word_v, double stddev, double& z0, double& z1) {
+		const double u = (toDouble(word_u) + 0.5) * kTwoToMinus32;
+		// a signed word gives the angle in [-1/2, 1/2) turn
+		const double v = (double)(int32_t)word_v * kTwoToMinus32;
+		const double r = stddev * sqrt(-2.0 * logUnit(u));
+		double sin_t, cos_t;
+		sinCosTurn(v, sin_t, cos_t);
+		z0 = r * cos_t;
+		z1 = r * sin_t;
+	}
+
+	/**
+	 * logUnit Natural log of x in (0, 1). x = 2^e m with m in [sqrt(1/2), sqrt(2)),
+	 *   log m = 2 atanh(s) with s = (m - 1) / (m + 1), |s| < 0.172.
+	 */
+	static double logUnit(double x) {
+		uint64_t bits;
+		memcpy(&bits, &x, sizeof(bits));
+
+		// halve m and bump the exponent when m is above sqrt(2), in integer arithmetic so
+		// there is no branch; the top 20 mantissa bits decide, which is close enough
+		const uint64_t mantissa = bits & 0x000FFFFFFFFFFFFFull;
+		const uint64_t high = (int32_t)(mantissa >> 32) > 0x6A09E ? 1 : 0;
+
+		// exponent field as a double: place it in the mantissa of 2^52
+		uint64_t e_bits = 0x4330000000000000ull | ((bits >> 52) + high);
+		double e;
+		memcpy(&e, &e_bits, sizeof(e));
+		e -= 4503599627370496.0 + 1023.0;
+
+		uint64_t m_bits = mantissa | ((1023 - high) << 52);
+		double m;
+		memcpy(&m, &m_bits, sizeof(m));
+
+		const double s = (m - 1.0) / (m + 1.0);
+		const double s2 = s * s;
+		const double series = 1.0 + s2 * (1.0 / 3 + s2 * (1.0 / 5 + s2 * (1.0 / 7 + s2 * (1.0 / 9 + s2 * (1.0 / 11
+				+ s2 * (1.0 / 13))))));
+		return e * M_LN2 + 2.0 * s * series;
+	}
+
+	/**
+	 * sinCosTurn sin and cos of 2 pi v for v in [-1/2, 1/2), from the Taylor series of the
+	 *   half angle in [-pi / 2, pi / 2) and the double angle formulas.
+	 */
+	static void sinCosTurn(double v, double& sin_t, double& cos_t) {
+		const double h = M_PI * v;
+		const double h2 = h * h;
+		// coefficients (-1)^k / (2k + 1)! and (-1)^k / (2k)!, folded by the compiler
+		const double sin_h = h * (1.0 + h2 * (-1.0 / 6 + h2 * (1.0 / 120 + h2 * (-1.0 / 5040 + h2 * (1.0 / 362880
+				+ h2 * (-1.0 / 39916800 + h2 * (1.0 / 6227020800.0 + h2 * (-1.0 / 1307674368000.0))))))));
+		const double cos_h = 1.0 + h2 * (-1.0 / 2 + h2 * (1.0 / 24 + h2 * (-1.0 / 720 + h2 * (1.0 / 40320
+				+ h2 * (-1.0 / 3628800 + h2 * (1.0 / 479001600 + h2 * (-1.0 / 87178291200.0 + h2 * (1.0
+				/ 20922789888000.0))))))));
+		sin_t = 2.0 * sin_h * cos_h;
+		cos_t = 1.0 - 2.0 * sin_h * sin_h;
+	}
+
+	uint32_t key[2];
+};
+
+#endif /* NORMAL_SAMPLER_H_ */
@@ -0,0 +1,72 @@
+/*
+ * pack_dataset.cpp
+ * Converts the text data of the particle filter into one dataset file and a tiled map.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+
+#include "dataset.h"
+#include "helper_functions.h"
+#include "tiled_map.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+
+	// directory with the text data and name of the dataset file
+	string data_dir = argc > 1 ? argv[1] : "data";
+	string output = argc > 2 ? argv[2] : data_dir + "/dataset.bin";
+	// tiled map next to the map data, tiles of a few sensor ranges
+	string tiles_output = argc > 3 ? argv[3] : data_dir + "/map_data.tiles";
+	double tile_size = argc > 4 ? atof(argv[4]) : 200;
+
+	Map map;
+	if (!read_map_data(data_dir + "/map_data.txt", map)) {
+		cout << "Error: Could not open map file" << endl;
+		return -1;
+	}
+
+	vector<control_s> position_meas;
+	if (!read_control_data(data_dir + "/control_data.txt", position_meas)) {
+		cout << "Error: Could not open position/control measurement file" << endl;
+		return -1;
+	}
+
+	vector<ground_truth> gt;
+	if (!read_gt_data(data_dir + "/gt_data.txt", gt)) {
+		cout << "Error: Could not open ground truth data file" << endl;
+		return -1;
+	}
+	if (gt.size() != position_meas.size()) {
+		cout << "Error: " << position_meas.size() << " control measurements but " << gt.size()
+				<< " ground truth positions" << endl;
+		return -1;
+	}
+
+	// one observation file per time step
+	vector<vector<LandmarkObs> > observations(position_meas.size());
+	for (int i = 0; i < observations.size(); ++i) {
+		ostringstream file;
+		file << data_dir << "/observation/observations_" << setfill('0') << setw(6) << i+1 << ".txt";
+		if (!read_landmark_data(file.str(), observations[i])) {
+			cout << "Error: Could not open observation file " << i+1 << endl;
+			return -1;
+		}
+	}
+
+	if (!write_dataset(output, map, position_meas, gt, observations)) {
+		cout << "Error: Could not write " << output << endl;
+		return -1;
+	}
+	cout << "Wrote " << output << ": " << map.landmark_list.size() << " landmarks, " << position_meas.size()
+			<< " time steps" << endl;
+
+	if (!write_tiled_map(tiles_output, map, tile_size)) {
+		cout << "Error: Could not write " << tiles_output << endl;
+		return -1;
+	}
+	cout << "Wrote " << tiles_output << ": " << tile_size << " m tiles" << endl;
+	return 0;
+}
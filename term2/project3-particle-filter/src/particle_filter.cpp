@@ -15,40 +15,100 @@
 
 #include "particle_filter.h"
 
+const int ParticleFilter::kChunkSize;
+const uint64_t ParticleFilter::kEmptyBin;
+
+/*
+ * Angle wrapped into [-pi, pi).
+ */
+static inline double wrapAngle(double angle) {
+    return angle - 2.0 * M_PI * floor((angle + M_PI) / (2.0 * M_PI));
+}
+
+/*
+ * Landmarks of a Map in range queries by id, as updateWeightsNearest takes them.
+ */
+struct MapLandmarks {
+
+    const LandmarkIndex& index;
+    const std::vector<Map::single_landmark_s>& landmark_list;
+
+    MapLandmarks(const LandmarkIndex& i, const std::vector<Map::single_landmark_s>& l) : index(i), landmark_list(l) {}
+
+    template <typename Visitor>
+    void forEachInRange(double x, double y, double range, Visitor visit) const {
+        index.forEachInRange(x, y, range, [&](int k, float lx, float ly) {
+            visit(landmark_list[k].id_i, lx, ly);
+        });
+    }
+};
+
+void ParticleFilter::setNumThreads(int num_threads) {
+    pool.resize(num_threads);
+}
+
+void ParticleFilter::setParticleLimits(int min_count, int max_count) {
+    min_particles = std::max(1, min_count);
+    max_particles = std::max(min_particles, max_count);
+}
+
+void ParticleFilter::setKldParameters(double epsilon, double z, double xy_bin_size, double theta_bin_size) {
+    kld_epsilon = epsilon;
+    kld_z = z;
+    bin_size_xy = xy_bin_size;
+    bin_size_theta = theta_bin_size;
+}
+
+bool ParticleFilter::useLikelihoodField(const Map& map, double std_landmark[], double resolution, double margin,
+                                        const std::string& cache_file, bool* loaded) {
+    use_likelihood_field = false;
+    if (loaded != NULL) {
+        *loaded = false;
+    }
+
+    if (!cache_file.empty() && likelihood_field.load(cache_file)
+        && likelihood_field.matches(map, std_landmark[0], std_landmark[1], resolution, margin)) {
+        if (loaded != NULL) {
+            *loaded = true;
+        }
+    }
+    else {
+        likelihood_field.build(map, std_landmark[0], std_landmark[1], resolution, margin);
+        // the lookup interpolates between 2 x 2 grid points
+        if (likelihood_field.empty()) {
+            return false;
+        }
+        if (!cache_file.empty()) {
+            likelihood_field.save(cache_file);
+        }
+    }
+
+    use_likelihood_field = true;
+    return true;
+}
+
 void ParticleFilter::init(double x, double y, double theta, double std[]) {
 	// Set the number of particles. Initialize all particles to first position (based on estimates of
 	//  x, y, theta and their uncertainties from GPS) and all weights to 1.
 	// Add random Gaussian noise to each particle.
 	// NOTE: Consult particle_filter.h for more information about this method (and others in this file).
 
-    num_particles = 200;
+    // start from the upper limit, KLD-sampling shrinks the set once it has converged
+    num_particles = max_particles;
 
-    std::default_random_engine gen;
-    // This line creates a normal (Gaussian) distribution for x, y and theta
-    std::normal_distribution<double> dist_x(0, std[0]);
-    std::normal_distribution<double> dist_y(0, std[1]);
-    std::normal_distribution<double> dist_theta(0, std[2]);
+    particle_x.assign(num_particles, x);
+    particle_y.assign(num_particles, y);
+    particle_theta.assign(num_particles, theta);
+    log_weights.assign(num_particles, -log((double)num_particles));
+    weights.resize(num_particles);
 
-    for (int i = 0; i < num_particles; i++) {
-        double sample_x, sample_y, sample_theta;
+    // Gaussian noise straight into the particle arrays
+    noise.add(kInitX, 0, 0, std[0], particle_x.data(), num_particles);
+    noise.add(kInitY, 0, 0, std[1], particle_y.data(), num_particles);
+    noise.add(kInitTheta, 0, 0, std[2], particle_theta.data(), num_particles);
 
-        // Sample  and from these normal distrubtions like this:
-        // sample_x = dist_x(gen);
-        // where "gen" is the random engine initialized earlier.
-        sample_x = dist_x(gen);
-        sample_y = dist_y(gen);
-        sample_theta = dist_theta(gen);
-
-        Particle particle;
-        particle.id = i;
-        particle.x = x + sample_x;
-        particle.y = y + sample_y;
-        particle.theta = theta + sample_theta;
-        particle.weight = 1.0;
-
-        weights.push_back(particle.weight);
-        particles.push_back(particle);
-    }
+    // equal weights, and the statistics of the initial cloud
+    normalizeWeights();
 
     // initialization done
     is_initialized = true;
@@ -60,48 +120,85 @@ void ParticleFilter::prediction(double delta_t, double std_pos[], double velocit
 	// http://en.cppreference.com/w/cpp/numeric/random/normal_distribution
 	// http://www.cplusplus.com/reference/random/default_random_engine/
 
-    std::default_random_engine gen;
-
-    // This line creates a normal (Gaussian) distribution for x, y and theta
-    std::normal_distribution<double> dist_x(0, std_pos[0]);
-    std::normal_distribution<double> dist_y(0, std_pos[1]);
-    std::normal_distribution<double> dist_theta(0, std_pos[2]);
-
-    for (int i = 0; i < num_particles; i++) {
-        //avoid division by zero
-        if (fabs(yaw_rate) > 0.001) {
-            particles[i].x += (velocity / yaw_rate) * (sin(particles[i].theta + yaw_rate * delta_t) - sin(particles[i].theta));
-            particles[i].y += (velocity / yaw_rate) * (cos(particles[i].theta) - cos(particles[i].theta + yaw_rate * delta_t));
-            particles[i].theta += yaw_rate * delta_t;
+    double* const x_data = particle_x.data();
+    double* const y_data = particle_y.data();
+    double* const theta_data = particle_theta.data();
+    const int n = num_particles;
+    const uint32_t cur_step = step++;
+
+    // the turn is the same for all particles, so expand
+    //   sin(theta + dtheta) - sin(theta) = sin(theta) (cos(dtheta) - 1) + cos(theta) sin(dtheta)
+    //   cos(theta) - cos(theta + dtheta) = cos(theta) (1 - cos(dtheta)) + sin(theta) sin(dtheta)
+    // to one sin and cos per particle; cos(dtheta) - 1 = -2 sin^2(dtheta / 2) avoids cancellation.
+    // The per-particle sin and cos are the sampler's polynomials, libm calls keep the loops scalar.
+    //avoid division by zero
+    const bool turning = fabs(yaw_rate) > 0.001;
+    const double dtheta = turning ? yaw_rate * delta_t : 0.0;
+    const double radius = turning ? velocity / yaw_rate : 0.0;
+    const double sin_half = sin(0.5 * dtheta);
+    const double a = radius * -2.0 * sin_half * sin_half;
+    const double b = radius * sin(dtheta);
+    const double distance = velocity * delta_t;
+
+    auto predict_chunk = [&](int chunk, int /* worker */) {
+        const int begin = chunk * kChunkSize;
+        const int end = std::min(n, begin + kChunkSize);
+
+        // locals, so the loops do not reload the pointers through the closure
+        double* const px = x_data;
+        double* const py = y_data;
+        double* const ptheta = theta_data;
+        const double sa = a, sb = b, sd = distance, st = dtheta;
+
+        if (turning) {
+#pragma omp simd
+            for (int i = begin; i < end; i++) {
+                double sin_theta, cos_theta;
+                NormalSampler::sinCos(ptheta[i], sin_theta, cos_theta);
+                px[i] += sin_theta * sa + cos_theta * sb;
+                py[i] += sin_theta * sb - cos_theta * sa;
+                ptheta[i] += st;
+            }
         }
         else {
-            particles[i].x += velocity * delta_t * cos(particles[i].theta);
-            particles[i].y += velocity * delta_t * sin(particles[i].theta);
+#pragma omp simd
+            for (int i = begin; i < end; i++) {
+                double sin_theta, cos_theta;
+                NormalSampler::sinCos(ptheta[i], sin_theta, cos_theta);
+                px[i] += sd * cos_theta;
+                py[i] += sd * sin_theta;
+            }
         }
 
-        particles[i].x +=  dist_x(gen);
-        particles[i].y +=  dist_y(gen);
-        particles[i].theta += dist_theta(gen);
-    }
+        // noise from the streams of (step, chunk), independent of the worker
+        noise.add(kMotionX, cur_step, chunk, std_pos[0], px + begin, end - begin);
+        noise.add(kMotionY, cur_step, chunk, std_pos[1], py + begin, end - begin);
+        noise.add(kMotionTheta, cur_step, chunk, std_pos[2], ptheta + begin, end - begin);
+    };
+    pool.run(numChunks(), predict_chunk);
 }
 
-void ParticleFilter::dataAssociation(std::vector<LandmarkObs> predicted, std::vector<LandmarkObs>& observations) {
+void ParticleFilter::dataAssociation(const std::vector<LandmarkObs>& predicted, std::vector<LandmarkObs>& observations) {
 	// Find the predicted measurement that is closest to each observed measurement and assign the
 	//  observed measurement to this particular landmark.
 	// NOTE: this method will NOT be called by the grading code. But you will probably find it useful to 
 	//  implement this method and use it as a helper during the updateWeights phase.
 
+    associate(predicted, observations, association_tree);
+}
+
+void ParticleFilter::associate(const std::vector<LandmarkObs>& predicted, std::vector<LandmarkObs>& observations,
+                               KdTree2D& tree) {
+    // no landmark to associate with, the observations keep id -1
+    if (predicted.empty()) {
+        return;
+    }
+
+    tree.build(predicted);
+
     for (int i = 0; i < observations.size(); i++) {
-        double min_dist = 1e8;
-        int min_index = -1;
-
-        for (int j = 0; j < predicted.size(); j++) {
-            double cur_dist = dist(observations[i].x, observations[i].y, predicted[j].x, predicted[j].y);
-            if (cur_dist < min_dist) {
-                min_dist = cur_dist;
-                min_index = j;
-            }
-        }
+        int min_index = tree.nearest(observations[i].x, observations[i].y);
+
         // assign nearest neighbor
         observations[i].id = predicted[min_index].id;
         // play some trick here, use delta distance instead of real distance
@@ -110,8 +207,75 @@ void ParticleFilter::dataAssociation(std::vector<LandmarkObs> predicted, std::ve
     }
 }
 
+template <typename Landmarks>
+void ParticleFilter::updateWeightsNearest(const Landmarks& landmarks, double sensor_range, double std_landmark[]) {
+    // according to https://en.wikipedia.org/wiki/Multivariate_normal_distribution
+    // Bivariate case (assume ρ = 0, which is the correlation between X and Y), in log space:
+    //   log p = -log(2 pi sx sy) - 0.5 dx^2 / sx^2 - 0.5 dy^2 / sy^2
+    const double sx = std_landmark[0];
+    const double sy = std_landmark[1];
+    const double log_norm = -log(2.0 * M_PI * sx * sy);
+    const double cx = -0.5 / (sx * sx);
+    const double cy = -0.5 / (sy * sy);
+    const int n_in_range = obs_in_range.size();
+
+    // an observation without a landmark in range counts as one at distance sensor_range
+    // along the wider axis, the best a landmark just out of range could give
+    const double unmatched_log_likelihood = log_norm + std::max(cx, cy) * sensor_range * sensor_range;
+
+    // update every particle, each worker with its own temporaries, reserved by reserveScratch
+    // for the most landmarks any particle can see
+    auto update_chunk = [&](int chunk, int worker) {
+        std::vector<LandmarkObs>& landmarks_on_map = scratch[worker].landmarks_on_map;
+        std::vector<LandmarkObs>& obs_on_map = scratch[worker].obs_on_map;
+        const int end = std::min(num_particles, (chunk + 1) * kChunkSize);
+
+        for (int i = chunk * kChunkSize; i < end; i++) {
+            // find possible landmarks in range of the particle
+            landmarks_on_map.clear();
+            landmarks.forEachInRange(particle_x[i], particle_y[i], sensor_range, [&](int id, float x, float y) {
+                LandmarkObs landmark;
+                landmark.id = id;
+                landmark.x = x;
+                landmark.y = y;
+                landmarks_on_map.push_back(landmark);
+            });
+
+            // convert observation to map's coordinate system
+            const double sin_theta = sin(particle_theta[i]);
+            const double cos_theta = cos(particle_theta[i]);
+            obs_on_map.resize(n_in_range);
+            for (int j = 0; j < n_in_range; j++) {
+                obs_on_map[j].id = -1;
+                obs_on_map[j].x = particle_x[i] + obs_in_range[j].x * cos_theta - obs_in_range[j].y * sin_theta;
+                obs_on_map[j].y = particle_y[i] + obs_in_range[j].x * sin_theta + obs_in_range[j].y * cos_theta;
+            }
+
+            // with no landmark in range nothing can explain the observations; associate leaves
+            // them in map coordinates, so weight them as matches at the edge of the range instead
+            if (landmarks_on_map.empty()) {
+                log_weights[i] += n_in_range * unmatched_log_likelihood;
+                continue;
+            }
+            associate(landmarks_on_map, obs_on_map, scratch[worker].tree);
+
+            // sum of the log densities, the normalizer is the same for every observation
+            const LandmarkObs* deltas = obs_on_map.data();
+            double log_weight = n_in_range * log_norm;
+
+#pragma omp simd reduction(+:log_weight)
+            for (int j = 0; j < n_in_range; j++) {
+                log_weight += cx * deltas[j].x * deltas[j].x + cy * deltas[j].y * deltas[j].y;
+            }
+
+            log_weights[i] += log_weight;
+        }
+    };
+    pool.run(numChunks(), update_chunk);
+}
+
 void ParticleFilter::updateWeights(double sensor_range, double std_landmark[], 
-		std::vector<LandmarkObs> observations, Map map_landmarks) {
+		const std::vector<LandmarkObs>& observations, const Map& map_landmarks) {
 	// Update the weights of each particle using a mult-variate Gaussian distribution. You can read
 	//   more about this distribution here: https://en.wikipedia.org/wiki/Multivariate_normal_distribution
 	// NOTE: The observations are given in the VEHICLE'S coordinate system. Your particles are located
@@ -124,80 +288,338 @@ void ParticleFilter::updateWeights(double sensor_range, double std_landmark[],
 	//   for the fact that the map's y-axis actually points downwards.)
 	// http://planning.cs.uiuc.edu/node99.html
 
-    // initial weights
-    weights.clear();
-    // update every particle
+    filterObservations(sensor_range, observations);
+
+    if (use_likelihood_field) {
+        updateWeightsField();
+        normalizeWeights();
+        return;
+    }
+
+    // maps built without read_map_data have no index, index them here once per map
+    const LandmarkIndex* index = &map_landmarks.index;
+    if (index->empty()) {
+        const std::vector<Map::single_landmark_s>& landmark_list = map_landmarks.landmark_list;
+        if (fallback_map != &map_landmarks || fallback_landmarks != landmark_list.data()
+                || fallback_size != landmark_list.size()) {
+            fallback_index.build(landmark_list);
+            fallback_map = &map_landmarks;
+            fallback_landmarks = landmark_list.data();
+            fallback_size = landmark_list.size();
+        }
+        index = &fallback_index;
+    }
+
+    if (range_bound_index != index || range_bound_size != index->size() || range_bound_range != sensor_range) {
+        range_bound = index->maxInRange(sensor_range);
+        range_bound_index = index;
+        range_bound_size = index->size();
+        range_bound_range = sensor_range;
+    }
+    reserveScratch(range_bound, observations.size());
+
+    updateWeightsNearest(MapLandmarks(*index, map_landmarks.landmark_list), sensor_range, std_landmark);
+    normalizeWeights();
+}
+
+void ParticleFilter::updateWeights(double sensor_range, double std_landmark[],
+        const std::vector<LandmarkObs>& observations, TiledMap& map_tiles) {
+    if (num_particles == 0) {
+        filterObservations(sensor_range, observations);
+        return;
+    }
+
+    // page in the tiles any particle can see: the bounding box of the cloud plus the range
+    double min_x = particle_x[0], max_x = particle_x[0];
+    double min_y = particle_y[0], max_y = particle_y[0];
+#pragma omp simd reduction(min:min_x, min_y) reduction(max:max_x, max_y)
     for (int i = 0; i < num_particles; i++) {
-        std::vector<LandmarkObs> landmarks_on_map;
-        std::vector<LandmarkObs> obs_on_map;
-
-        // find possible landmarks in range
-        for (int j = 0; j < map_landmarks.landmark_list.size(); j++) {
-            double cur_dist = dist(map_landmarks.landmark_list[j].x_f, map_landmarks.landmark_list[j].y_f,
-                                   particles[j].x, particles[j].y);
-            if (cur_dist <= sensor_range) {
-                LandmarkObs landmark;
-                landmark.id = map_landmarks.landmark_list[j].id_i;
-                landmark.x = map_landmarks.landmark_list[j].x_f;
-                landmark.y = map_landmarks.landmark_list[j].y_f;
+        min_x = std::min(min_x, particle_x[i]);
+        max_x = std::max(max_x, particle_x[i]);
+        min_y = std::min(min_y, particle_y[i]);
+        max_y = std::max(max_y, particle_y[i]);
+    }
+    map_tiles.page(min_x - sensor_range, min_y - sensor_range, max_x + sensor_range, max_y + sensor_range);
 
-                landmarks_on_map.push_back(landmark);
-            }
+    // no particle sees more than the paged tiles hold
+    reserveScratch(map_tiles.loadedLandmarks(), observations.size());
+    filterObservations(sensor_range, observations);
+
+    updateWeightsNearest(map_tiles, sensor_range, std_landmark);
+    normalizeWeights();
+}
+
+void ParticleFilter::reserveScratch(int max_landmarks, int num_observations) {
+    // an observation beyond the landmarks in range is rare, so reserving for the landmarks
+    // covers later steps with more observations too
+    const int max_observations = std::max(max_landmarks, num_observations);
+    scratch.resize(pool.size());
+    obs_in_range.reserve(max_observations);
+    for (int w = 0; w < scratch.size(); w++) {
+        scratch[w].landmarks_on_map.reserve(max_landmarks);
+        scratch[w].obs_on_map.reserve(max_observations);
+        scratch[w].tree.reserve(max_landmarks);
+    }
+}
+
+void ParticleFilter::filterObservations(double sensor_range, const std::vector<LandmarkObs>& observations) {
+    // the range check does not depend on the particle
+    obs_in_range.clear();
+    for (int j = 0; j < observations.size(); j++) {
+        if (dist(observations[j].x, observations[j].y, 0, 0) <= sensor_range) {
+            obs_in_range.push_back(observations[j]);
         }
+    }
+}
 
-        // convert observation to map's coordinate system
-        for (int j = 0; j < observations.size(); j++) {
-            double cur_dist = dist(observations[j].x, observations[j].y, 0, 0);
-            if (cur_dist <= sensor_range) {
-                LandmarkObs landmark;
-                landmark.id = -1;
-                landmark.x = particles[i].x + observations[j].x * cos(particles[i].theta) - observations[j].y * sin(particles[i].theta);
-                landmark.y = particles[i].y + observations[j].x * sin(particles[i].theta) + observations[j].y * cos(particles[i].theta);
+void ParticleFilter::updateWeightsField() {
+    const int n_obs = obs_in_range.size();
 
-                obs_on_map.push_back(landmark);
+    auto update_chunk = [&](int chunk, int /* worker */) {
+        const int end = std::min(num_particles, (chunk + 1) * kChunkSize);
+
+        for (int i = chunk * kChunkSize; i < end; i++) {
+            const double sin_theta = sin(particle_theta[i]);
+            const double cos_theta = cos(particle_theta[i]);
+
+            double log_weight = 0.0;
+            for (int j = 0; j < n_obs; j++) {
+                const double x = particle_x[i] + obs_in_range[j].x * cos_theta - obs_in_range[j].y * sin_theta;
+                const double y = particle_y[i] + obs_in_range[j].x * sin_theta + obs_in_range[j].y * cos_theta;
+                log_weight += likelihood_field.logLikelihood(x, y);
             }
+            log_weights[i] += log_weight;
         }
+    };
+    pool.run(numChunks(), update_chunk);
+}
 
-        dataAssociation(landmarks_on_map, obs_on_map);
+bool ParticleFilter::resample() {
+	// Resample particles with replacement with probability proportional to their weight.
+	// NOTE: You may find std::discrete_distribution helpful here.
+	// http://en.cppreference.com/w/cpp/numeric/random/discrete_distribution
+
+    // weights close to uniform still describe the posterior well, keep them and the
+    // diversity of the particles
+    if (num_particles == 0 || effective_sample_size >= resample_threshold * num_particles) {
+        return false;
+    }
+
+    if (min_particles < max_particles) {
+        resampleKld();
+    }
+    else {
+        resampleSystematic();
+    }
 
-        // initial weight
-        double weight = 1.0;
-        double sx = std_landmark[0];
-        double sy = std_landmark[1];
+    particle_x.swap(next_x);
+    particle_y.swap(next_y);
+    particle_theta.swap(next_theta);
 
-        // according to https://en.wikipedia.org/wiki/Multivariate_normal_distribution
-        // Bivariate case (assume ρ = 0, which is the correlation between X and Y)
-        for (int j = 0; j < obs_on_map.size(); j++){
-            double dx = obs_on_map[j].x;
-            double dy = obs_on_map[j].y;
+    // the resampled particles represent the posterior with equal weights
+    log_weights.assign(num_particles, -log((double)num_particles));
+    weights.assign(num_particles, 1.0 / num_particles);
+    effective_sample_size = num_particles;
+    return true;
+}
 
-            weight *= (1.0 / (2.0 * M_PI * sx * sy)) * exp(-0.5 * ((dx * dx) / (sx * sx) + (dy * dy) / (sy * sy)));
+void ParticleFilter::resampleSystematic() {
+    const int n = num_particles;
+    next_x.resize(n);
+    next_y.resize(n);
+    next_theta.resize(n);
+
+    // pointers at (u + i) / N, u uniform in [0, 1)
+    std::uniform_real_distribution<double> dist(0.0, 1.0);
+    const double spacing = 1.0 / n;
+    double pointer = dist(resample_gen) * spacing;
+    double cumulative = weights[0];
+    int index = 0;
+
+    for (int i = 0; i < n; i++) {
+        // rounding can leave the last cumulative weight just below 1
+        while (pointer > cumulative && index < n - 1) {
+            index++;
+            cumulative += weights[index];
+        }
+        next_x[i] = particle_x[index];
+        next_y[i] = particle_y[index];
+        next_theta[i] = particle_theta[index];
+        pointer += spacing;
+    }
+}
+
+void ParticleFilter::resampleKld() {
+    // Fox, "Adapting the sample size in particle filters through KLD-sampling" (IJRR 2003):
+    // draw until the particles cover k bins of the histogram and there are enough of them
+    // for the KL divergence between the sample and the true posterior to stay below epsilon
+    // with probability 1 - delta, z being the upper 1 - delta quantile of the standard normal.
+    next_x.resize(max_particles);
+    next_y.resize(max_particles);
+    next_theta.resize(max_particles);
+
+    cumulative_weights.resize(num_particles);
+    std::partial_sum(weights.begin(), weights.end(), cumulative_weights.begin());
+    const double total = cumulative_weights.back();
+
+    // open addressing hash set of the occupied bins, at most half full
+    int table_size = 1;
+    while (table_size < 2 * max_particles) {
+        table_size *= 2;
+    }
+    bin_table.assign(table_size, kEmptyBin);
+
+    std::uniform_real_distribution<double> dist(0.0, total);
+    int bins = 0;
+    int n_required = min_particles;
+    int n = 0;
+
+    while (n < max_particles && (n < n_required || n < min_particles)) {
+        // draws are independent, so the bins fill in at the rate of the posterior
+        int index = std::upper_bound(cumulative_weights.begin(), cumulative_weights.end(), dist(resample_gen))
+                    - cumulative_weights.begin();
+        index = std::min(index, num_particles - 1);
+
+        next_x[n] = particle_x[index];
+        next_y[n] = particle_y[index];
+        next_theta[n] = particle_theta[index];
+        n++;
+
+        if (insertBin(next_x[n - 1], next_y[n - 1], next_theta[n - 1])) {
+            bins++;
+            if (bins > 1) {
+                // Wilson-Hilferty approximation of the chi-square quantile with k - 1 degrees of freedom
+                const double a = 2.0 / (9.0 * (bins - 1));
+                const double c = 1.0 - a + sqrt(a) * kld_z;
+                n_required = (int)ceil((bins - 1) / (2.0 * kld_epsilon) * c * c * c);
+            }
         }
+    }
 
-        weights.push_back(weight);
-        particles[i].weight = weight;
+    num_particles = n;
+    next_x.resize(n);
+    next_y.resize(n);
+    next_theta.resize(n);
+}
 
+bool ParticleFilter::insertBin(double x, double y, double theta) {
+    // wrap theta into [0, 2 pi) so headings a turn apart share a bin
+    const double wrapped = theta - 2.0 * M_PI * floor(theta / (2.0 * M_PI));
+    const int64_t bx = (int64_t)floor(x / bin_size_xy);
+    const int64_t by = (int64_t)floor(y / bin_size_xy);
+    const int64_t bt = (int64_t)floor(wrapped / bin_size_theta);
+
+    // 24 bits per coordinate, offset to keep them non-negative
+    const uint64_t key = ((uint64_t)(bx + (1 << 23)) & 0xFFFFFF) << 40
+                       | ((uint64_t)(by + (1 << 23)) & 0xFFFFFF) << 16
+                       | ((uint64_t)bt & 0xFFFF);
+
+    const size_t mask = bin_table.size() - 1;
+    size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    while (bin_table[slot] != kEmptyBin) {
+        if (bin_table[slot] == key) {
+            return false;
+        }
+        slot = (slot + 1) & mask;
     }
+    bin_table[slot] = key;
+    return true;
 }
 
-void ParticleFilter::resample() {
-	// Resample particles with replacement with probability proportional to their weight.
-	// NOTE: You may find std::discrete_distribution helpful here.
-	// http://en.cppreference.com/w/cpp/numeric/random/discrete_distribution
+void ParticleFilter::normalizeWeights() {
+    if (num_particles == 0) {
+        return;
+    }
 
-    std::default_random_engine gen;
-    std::discrete_distribution<int> dist(weights.cbegin(), weights.cend());
+    // log-sum-exp: shift by the largest log weight so the largest weight is exp(0) = 1
+    const int best = std::max_element(log_weights.begin(), log_weights.begin() + num_particles) - log_weights.begin();
+    const double max_log_weight = log_weights[best];
+
+    // the cloud statistics come out of the same pass, as moments of the offsets to the
+    // best particle: small offsets keep the sums accurate far from the map origin, and
+    // heading offsets wrapped into [-pi, pi) handle clouds across the +-pi seam
+    const double ref_x = particle_x[best];
+    const double ref_y = particle_y[best];
+    const double ref_theta = particle_theta[best];
+    double sum = 0.0;
+    double sum_squares = 0.0;
+    double sum_x = 0.0, sum_y = 0.0, sum_theta = 0.0, sum_sin = 0.0, sum_cos = 0.0;
+    double sum_xx = 0.0, sum_xy = 0.0, sum_xt = 0.0, sum_yy = 0.0, sum_yt = 0.0, sum_tt = 0.0;
+    for (int i = 0; i < num_particles; i++) {
+        const double w = exp(log_weights[i] - max_log_weight);
+        weights[i] = w;
+        sum += w;
+        sum_squares += w * w;
+
+        const double dx = particle_x[i] - ref_x;
+        const double dy = particle_y[i] - ref_y;
+        const double dt = wrapAngle(particle_theta[i] - ref_theta);
+        sum_x += w * dx;
+        sum_y += w * dy;
+        sum_theta += w * dt;
+        sum_sin += w * sin(dt);
+        sum_cos += w * cos(dt);
+        sum_xx += w * dx * dx;
+        sum_xy += w * dx * dy;
+        sum_xt += w * dx * dt;
+        sum_yy += w * dy * dy;
+        sum_yt += w * dy * dt;
+        sum_tt += w * dt * dt;
+    }
 
-    // Make a copy of current particles
-    std::vector<Particle> temp_particles = particles;
-    particles.clear();
+    // ESS = 1 / sum of the squared normalized weights
+    effective_sample_size = sum * sum / sum_squares;
 
+    // normalize the log weights too, so they stay bounded while they carry over between steps
+    const double scale = 1.0 / sum;
+    const double log_scale = max_log_weight + log(sum);
     for (int i = 0; i < num_particles; i++) {
-        Particle particle;
-        int index = dist(gen);
-        particle = temp_particles[index];
-        particles.push_back(particle);
+        weights[i] *= scale;
+        log_weights[i] -= log_scale;
+    }
+
+    best_particle.id = best;
+    best_particle.x = ref_x;
+    best_particle.y = ref_y;
+    best_particle.theta = ref_theta;
+    best_particle.weight = weights[best];
+
+    // means of the offsets, the heading as the circular mean
+    const double mx = sum_x * scale;
+    const double my = sum_y * scale;
+    const double mt = atan2(sum_sin, sum_cos);
+    pose_stats.x = ref_x + mx;
+    pose_stats.y = ref_y + my;
+    pose_stats.theta = ref_theta + mt;
+
+    // E[(a - ma)(b - mb)] from the raw moments; the heading deviations are taken around the
+    // circular mean, which need not be the linear mean of the offsets
+    const double et = sum_theta * scale;
+    pose_stats.covariance[0][0] = sum_xx * scale - mx * mx;
+    pose_stats.covariance[0][1] = sum_xy * scale - mx * my;
+    pose_stats.covariance[0][2] = sum_xt * scale - mx * et;
+    pose_stats.covariance[1][1] = sum_yy * scale - my * my;
+    pose_stats.covariance[1][2] = sum_yt * scale - my * et;
+    pose_stats.covariance[2][2] = sum_tt * scale - 2.0 * mt * et + mt * mt;
+    pose_stats.covariance[1][0] = pose_stats.covariance[0][1];
+    pose_stats.covariance[2][0] = pose_stats.covariance[0][2];
+    pose_stats.covariance[2][1] = pose_stats.covariance[1][2];
+}
+
+size_t ParticleFilter::memoryUsage() const {
+    size_t bytes = (particle_x.capacity() + particle_y.capacity() + particle_theta.capacity()
+                    + log_weights.capacity() + weights.capacity() + next_x.capacity() + next_y.capacity()
+                    + next_theta.capacity() + cumulative_weights.capacity()) * sizeof(double)
+                   + bin_table.capacity() * sizeof(uint64_t)
+                   + obs_in_range.capacity() * sizeof(LandmarkObs)
+                   + association_tree.memoryUsage() + likelihood_field.memoryUsage()
+                   + fallback_index.memoryUsage()
+                   + scratch.capacity() * sizeof(Scratch);
+    for (size_t i = 0; i < scratch.size(); i++) {
+        bytes += (scratch[i].landmarks_on_map.capacity() + scratch[i].obs_on_map.capacity()) * sizeof(LandmarkObs)
+                 + scratch[i].tree.memoryUsage();
     }
+    return bytes;
 }
 
 void ParticleFilter::write(std::string filename) {
@@ -205,7 +627,7 @@ void ParticleFilter::write(std::string filename) {
 	std::ofstream dataFile;
 	dataFile.open(filename, std::ios::app);
 	for (int i = 0; i < num_particles; ++i) {
-		dataFile << particles[i].x << " " << particles[i].y << " " << particles[i].theta << "\n";
+		dataFile << particle_x[i] << " " << particle_y[i] << " " << particle_theta[i] << "\n";
 	}
 	dataFile.close();
 }
@@ -9,7 +9,13 @@
 #ifndef PARTICLE_FILTER_H_
 #define PARTICLE_FILTER_H_
 
+#include <random>
 #include "helper_functions.h"
+#include "kd_tree.h"
+#include "likelihood_field.h"
+#include "normal_sampler.h"
+#include "tiled_map.h"
+#include "worker_pool.h"
 
 struct Particle {
 
@@ -20,29 +26,250 @@ struct Particle {
 	double weight;
 };
 
+/*
+ * Read-only view of the particle arrays. A Particle is gathered from the
+ * arrays when an element is read, nothing is copied or allocated up front.
+ * The view reads the current values until the particle arrays are resized
+ * (init, or resample with KLD-sampling).
+ */
+class ParticleView {
+public:
+
+	class const_iterator {
+	public:
+		const_iterator(const ParticleView* view, int index) : view(view), index(index) {}
+		Particle operator*() const { return (*view)[index]; }
+		const_iterator& operator++() { ++index; return *this; }
+		bool operator==(const const_iterator& other) const { return index == other.index; }
+		bool operator!=(const const_iterator& other) const { return index != other.index; }
+
+	private:
+		const ParticleView* view;
+		int index;
+	};
+
+	ParticleView(const double* x, const double* y, const double* theta, const double* weight, int n)
+		: x(x), y(y), theta(theta), weight(weight), n(n) {}
+
+	int size() const {
+		return n;
+	}
+
+	// Particle i, id is its index
+	Particle operator[](int i) const {
+		Particle p = {i, x[i], y[i], theta[i], weight[i]};
+		return p;
+	}
+
+	const_iterator begin() const {
+		return const_iterator(this, 0);
+	}
+
+	const_iterator end() const {
+		return const_iterator(this, n);
+	}
+
+private:
+	const double* x;
+	const double* y;
+	const double* theta;
+	const double* weight;
+	int n;
+};
+
 
 
+/*
+ * Weighted mean and covariance of the particle poses.
+ */
+struct PoseStats {
+
+	// Weighted mean position [m] and circular mean heading [rad], the heading on the
+	// same turn as the particles
+	double x;
+	double y;
+	double theta;
+
+	// Weighted covariance of (x, y, theta), the heading deviations taken around its circular mean
+	double covariance[3][3];
+};
+
 class ParticleFilter {
 	
 	// Number of particles to draw
 	int num_particles; 
+
+	// Limits of num_particles, KLD-sampling adapts it in between when they differ
+	int min_particles;
+	int max_particles;
+
+	// KLD-sampling error bound epsilon and normal quantile z of 1 - delta
+	double kld_epsilon;
+	double kld_z;
+
+	// Histogram bin sizes of KLD-sampling [m] and [rad]
+	double bin_size_xy;
+	double bin_size_theta;
 	
 	
 	
 	// Flag, if filter is initialized
 	bool is_initialized;
 	
-	// Vector of weights of all particles
+	// Particle states as structure of arrays, particle i is
+	// (particle_x[i], particle_y[i], particle_theta[i]) with weight weights[i]
+	std::vector<double> particle_x;
+	std::vector<double> particle_y;
+	std::vector<double> particle_theta;
+
+	// Normalized log weights of the particles, updateWeights adds the log likelihoods
+	// of each step until resample resets them to equal
+	std::vector<double> log_weights;
+
+	// Vector of weights of all particles, normalized from log_weights by updateWeights
 	std::vector<double> weights;
+
+	// Effective sample size 1 / sum(weights^2) of the current weights
+	double effective_sample_size;
+
+	// resample draws new particles only while effective_sample_size < resample_threshold * N
+	double resample_threshold;
+
+	// Highest weighted particle and cloud statistics, computed by normalizeWeights
+	Particle best_particle;
+	PoseStats pose_stats;
+
+	// Back buffers resample writes into before swapping them with the particle arrays
+	std::vector<double> next_x;
+	std::vector<double> next_y;
+	std::vector<double> next_theta;
+
+	// Random engine of resample, kept across steps
+	std::default_random_engine resample_gen;
+
+	// Running sum of weights and hash set of occupied bins of resampleKld, reused between calls
+	std::vector<double> cumulative_weights;
+	std::vector<uint64_t> bin_table;
+	static const uint64_t kEmptyBin = ~0ull;
+
+	// Nearest neighbor search over the predicted landmarks of dataAssociation, reused between calls
+	KdTree2D association_tree;
+
+	// Raster of observation log likelihoods, used by updateWeights instead of the
+	// association when use_likelihood_field is set
+	LikelihoodField likelihood_field;
+	bool use_likelihood_field;
+
+	// Observations of updateWeights within sensor range, reused between calls
+	std::vector<LandmarkObs> obs_in_range;
+
+	// Index of updateWeights for maps without one, and the map and landmark list it was
+	// built for; a list changed in place at the same size needs Map::buildIndex instead
+	LandmarkIndex fallback_index;
+	const Map* fallback_map;
+	const Map::single_landmark_s* fallback_landmarks;
+	size_t fallback_size;
+
+	// Most landmarks within sensor range of any point of the index updateWeights last used,
+	// and the index, its size and the range the bound is for
+	int range_bound;
+	const LandmarkIndex* range_bound_index;
+	int range_bound_size;
+	double range_bound_range;
+
+	// Threads running prediction and updateWeights over chunks of kChunkSize particles
+	WorkerPool pool;
+
+	// Temporaries of updateWeights, one set per worker
+	struct Scratch {
+		std::vector<LandmarkObs> landmarks_on_map;
+		std::vector<LandmarkObs> obs_on_map;
+		KdTree2D tree;
+	};
+	std::vector<Scratch> scratch;
+
+	// Gaussian noise of init and prediction, chunk c of prediction step s draws
+	// from streams (kMotionX + dimension, s, c)
+	NormalSampler noise;
+	enum NoiseStream { kInitX, kInitY, kInitTheta, kMotionX, kMotionY, kMotionTheta };
+
+	// Number of prediction steps so far
+	uint32_t step;
 	
 public:
-	
-	// Set of current particles
-	std::vector<Particle> particles;
 
 	// Constructor
 	// @param M Number of particles
-	ParticleFilter() : num_particles(0), is_initialized(false) {}
+	ParticleFilter() : num_particles(0), min_particles(200), max_particles(200), kld_epsilon(0.05), kld_z(2.326),
+			bin_size_xy(0.5), bin_size_theta(10.0 * M_PI / 180.0), is_initialized(false), effective_sample_size(0),
+			resample_threshold(1.0),
+			use_likelihood_field(false), fallback_map(NULL), fallback_landmarks(NULL), fallback_size(0),
+			range_bound(0), range_bound_index(NULL), range_bound_size(0), range_bound_range(0), step(0) {}
+
+	// Particles per chunk of work. The random streams belong to chunks, not
+	// threads, so results do not depend on the number of threads.
+	static const int kChunkSize = 128;
+
+	/**
+	 * setNumThreads Sets the number of threads of prediction and updateWeights.
+	 * @param num_threads Number of threads including the calling one, at least 1
+	 */
+	void setNumThreads(int num_threads);
+
+	/**
+	 * setParticleLimits Sets the range of the number of particles. init draws max_count particles;
+	 *   if min_count < max_count, resample picks the number in between with KLD-sampling,
+	 *   otherwise the number stays fixed.
+	 * @param min_count Fewest particles after resampling
+	 * @param max_count Most particles after resampling, and the number init draws
+	 */
+	void setParticleLimits(int min_count, int max_count);
+
+	/**
+	 * setKldParameters Sets the KLD-sampling bound and histogram.
+	 * @param epsilon Bound on the KL divergence between sample and posterior
+	 * @param z Upper 1 - delta quantile of the standard normal, the bound holds with probability 1 - delta
+	 * @param xy_bin_size Bin size of x and y [m]
+	 * @param theta_bin_size Bin size of the heading [rad]
+	 */
+	void setKldParameters(double epsilon, double z, double xy_bin_size, double theta_bin_size);
+
+	/**
+	 * setResampleThreshold Sets when resample draws new particles: only while the effective
+	 *   sample size is below fraction * N, otherwise the weights carry over to the next step.
+	 *   The default 1 resamples whenever the weights are not all equal.
+	 * @param fraction Fraction of the number of particles, in (0, 1]
+	 */
+	void setResampleThreshold(double fraction) {
+		resample_threshold = fraction;
+	}
+
+	/**
+	 * useLikelihoodField Switches updateWeights to the likelihood field of the map: each
+	 *   observation is weighted by a lookup at its map position instead of an association.
+	 *   The field is read from cache_file if it was saved there for the same map and
+	 *   parameters, otherwise built and saved there.
+	 * @param map Map class containing map landmarks
+	 * @param std_landmark[] Array of dimension 2 [standard deviation of x [m], standard deviation of y [m]]
+	 * @param resolution Grid spacing of the field [m]
+	 * @param margin Extent of the field beyond the landmarks [m], e.g. the sensor range
+	 * @param cache_file File to load the field from or save it to, empty for none
+	 * @param loaded If not NULL, set to whether the field was loaded from cache_file
+	 * @output True if the field is in use; false if it is smaller than 2 x 2 grid points (no
+	 *   landmarks, resolution <= 0), updateWeights then keeps associating
+	 */
+	bool useLikelihoodField(const Map& map, double std_landmark[], double resolution, double margin,
+			const std::string& cache_file = "", bool* loaded = NULL);
+
+	/**
+	 * setSeed Sets the key of the init and prediction noise and restarts its streams,
+	 *   and reseeds the resampling engine.
+	 */
+	void setSeed(uint64_t seed) {
+		noise.setSeed(seed);
+		resample_gen.seed(seed);
+		step = 0;
+	}
 
 	// Destructor
 	~ParticleFilter() {}
@@ -71,29 +298,116 @@ public:
 	
 	/**
 	 * dataAssociation Finds which observations correspond to which landmarks (likely by using
-	 *   a nearest-neighbors data association).
+	 *   a nearest-neighbors data association). The nearest predicted landmark is found with
+	 *   squared distances in a k-d tree, O(log m) per observation for m predicted landmarks.
+	 *   Each observation gets the landmark id and is replaced by its offset to the landmark.
 	 * @param predicted Vector of predicted landmark observations
 	 * @param observations Vector of landmark observations
 	 */
-	void dataAssociation(std::vector<LandmarkObs> predicted, std::vector<LandmarkObs>& observations);
+	void dataAssociation(const std::vector<LandmarkObs>& predicted, std::vector<LandmarkObs>& observations);
 	
 	/**
 	 * updateWeights Updates the weights for each particle based on the likelihood of the 
-	 *   observed measurements. 
+	 *   observed measurements. The weights are kept as log likelihoods, so many observations
+	 *   cannot underflow them to zero; they are normalized and the effective sample size
+	 *   computed at the end.
 	 * @param sensor_range Range [m] of sensor
 	 * @param std_landmark[] Array of dimension 2 [standard deviation of range [m],
 	 *   standard deviation of bearing [rad]]
 	 * @param observations Vector of landmark observations
 	 * @param map Map class containing map landmarks
 	 */
-	void updateWeights(double sensor_range, double std_landmark[], std::vector<LandmarkObs> observations,
-			Map map_landmarks);
+	void updateWeights(double sensor_range, double std_landmark[], const std::vector<LandmarkObs>& observations,
+			const Map& map_landmarks);
+
+	/**
+	 * updateWeights updateWeights with a tiled map: first pages in the tiles overlapping the
+	 *   bounding box of the particles grown by sensor_range, then associates with their
+	 *   landmarks. The likelihood field is not used with tiled maps.
+	 * @param sensor_range Range [m] of sensor
+	 * @param std_landmark[] Array of dimension 2 [standard deviation of range [m],
+	 *   standard deviation of bearing [rad]]
+	 * @param observations Vector of landmark observations
+	 * @param map_tiles Open tiled map, its tile cache is updated
+	 */
+	void updateWeights(double sensor_range, double std_landmark[], const std::vector<LandmarkObs>& observations,
+			TiledMap& map_tiles);
 	
 	/**
 	 * resample Resamples from the updated set of particles to form
-	 *   the new set of particles.
+	 *   the new set of particles, with resampleSystematic for a fixed number of particles
+	 *   and resampleKld otherwise, if the effective sample size is below the resample threshold.
+	 * @output True if the particles were resampled
+	 */
+	bool resample();
+
+private:
+
+	/**
+	 * normalizeWeights Normalizes log_weights with log-sum-exp, sets weights to their exp
+	 *   and computes effective_sample_size, best_particle and pose_stats in the same pass.
+	 */
+	void normalizeWeights();
+
+	/**
+	 * reserveScratch Reserves the temporaries of updateWeights for max_landmarks landmarks
+	 *   in range of a particle and as many observations or num_observations, whichever is
+	 *   more, so that a later step with more of either does not allocate.
+	 */
+	void reserveScratch(int max_landmarks, int num_observations);
+
+	/**
+	 * filterObservations Copies the observations within sensor range to obs_in_range.
+	 */
+	void filterObservations(double sensor_range, const std::vector<LandmarkObs>& observations);
+
+	/**
+	 * updateWeightsNearest Adds the log likelihoods of obs_in_range, each associated with the
+	 *   nearest landmark within sensor range of the particle, to log_weights. Particles with
+	 *   no landmark in range get the fixed likelihood of a match at sensor_range per observation.
+	 * @param landmarks Map or tiles with forEachInRange(x, y, range, visit(id, x, y))
+	 */
+	template <typename Landmarks>
+	void updateWeightsNearest(const Landmarks& landmarks, double sensor_range, double std_landmark[]);
+
+	/**
+	 * updateWeightsField updateWeights with the likelihood field, adds the sum of the field over
+	 *   obs_in_range at their map positions to log_weights.
+	 */
+	void updateWeightsField();
+
+	/**
+	 * resampleSystematic Systematic (low variance) resampling into the back buffers: one uniform
+	 *   offset, then N evenly spaced pointers walk the cumulative weights in one pass.
+	 */
+	void resampleSystematic();
+
+	/**
+	 * resampleKld KLD-sampling into the back buffers: independent draws until the number of
+	 *   particles meets the bound for the number of occupied x/y/theta bins, within the limits.
+	 */
+	void resampleKld();
+
+	/**
+	 * insertBin Adds the bin of the pose to bin_table.
+	 * @output True if the bin was empty
 	 */
-	void resample();
+	bool insertBin(double x, double y, double theta);
+
+	/**
+	 * associate dataAssociation with the given tree, so workers can use their own.
+	 */
+	void associate(const std::vector<LandmarkObs>& predicted, std::vector<LandmarkObs>& observations,
+			KdTree2D& tree);
+
+	/**
+	 * numChunks Number of chunks of kChunkSize particles.
+	 */
+	int numChunks() const {
+		return (num_particles + kChunkSize - 1) / kChunkSize;
+	}
+
+public:
 	
 	/*
 	 * write Writes particle positions to a file.
@@ -101,6 +415,50 @@ public:
 	 */
 	void write(std::string filename);
 	
+	/**
+	 * particles View of the current particles over the particle arrays, see ParticleView.
+	 */
+	ParticleView particles() const {
+		return ParticleView(particle_x.data(), particle_y.data(), particle_theta.data(), weights.data(),
+				num_particles);
+	}
+
+	/**
+	 * size Number of particles.
+	 */
+	int size() const {
+		return num_particles;
+	}
+
+	/**
+	 * memoryUsage Bytes of the buffers the filter holds (their capacities), without the map,
+	 *   the tiled map or the worker threads.
+	 */
+	size_t memoryUsage() const;
+
+	/**
+	 * effectiveSampleSize Effective sample size of the current weights, N when they are equal.
+	 */
+	double effectiveSampleSize() const {
+		return effective_sample_size;
+	}
+
+	/**
+	 * bestParticle Particle with the highest weight at the last updateWeights (or init), id is
+	 *   its index then. Resampling leaves it as it was.
+	 */
+	const Particle& bestParticle() const {
+		return best_particle;
+	}
+
+	/**
+	 * poseStats Weighted mean pose and covariance of the particles at the last updateWeights
+	 *   (or init). Resampling leaves them as they were.
+	 */
+	const PoseStats& poseStats() const {
+		return pose_stats;
+	}
+
 	/**
 	 * initialized Returns whether particle filter is initialized yet or not.
 	 */
@@ -0,0 +1,402 @@
+/*
+ * pf_benchmark.cpp
+ * Scaling benchmark of the particle filter over particle and landmark counts.
+ *
+ * Runs ParticleFilter with a fixed number of particles and threads on the
+ * bundled data and on synthetic maps, and reports latency percentiles of prediction,
+ * updateWeights and resample, particle throughput, heap allocations after
+ * warm-up, the speedup over the first thread count and the memory the filter
+ * holds. Build with
+ * -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dataset.h"
+#include "helper_functions.h"
+#include "particle_filter.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static unsigned long long g_allocations = 0;
+
+#if defined(__GLIBC__)
+// count on the malloc level, that covers operator new as well
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+	g_allocations++;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+	g_allocations++;
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+	g_allocations++;
+	return __libc_realloc(ptr, size);
+}
+}
+#else
+void* operator new(size_t size) {
+	g_allocations++;
+	void* p = malloc(size == 0 ? 1 : size);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+#endif
+
+// Steps before the allocation count starts, the buffers grow to size in these
+const int warm_up_steps = 3;
+
+// Parameters of main
+const double delta_t = 0.1;
+const double sensor_range = 50;
+double sigma_pos[3] = {0.3, 0.3, 0.01};
+double sigma_landmark[2] = {0.3, 0.3};
+
+/*
+ * Map, controls, ground truth and observations of a replay.
+ */
+struct Scenario {
+
+	string name;
+	Map map;
+	vector<control_s> controls;
+	vector<ground_truth> gt;
+	vector<vector<LandmarkObs> > observations;
+};
+
+/* Reads the bundled data, from the packed dataset if there is one.
+ * @param data_dir Directory of the data
+ * @param steps Number of time steps to read at most
+ * @output True if reading was successful
+ */
+bool read_bundled(const string& data_dir, int steps, Scenario& scenario) {
+	scenario.name = "bundled";
+
+	MappedDataset dataset;
+	if (dataset.open(data_dir + "/dataset.bin")) {
+		dataset.readMap(scenario.map);
+		const int n = min(steps, dataset.steps());
+		scenario.controls.assign(dataset.controls(), dataset.controls() + n);
+		scenario.gt.assign(dataset.groundTruth(), dataset.groundTruth() + n);
+		scenario.observations.resize(n);
+		for (int i = 0; i < n; i++) {
+			dataset.readObservations(i, scenario.observations[i]);
+		}
+		return true;
+	}
+
+	if (!read_map_data(data_dir + "/map_data.txt", scenario.map)
+			|| !read_control_data(data_dir + "/control_data.txt", scenario.controls)
+			|| !read_gt_data(data_dir + "/gt_data.txt", scenario.gt)) {
+		return false;
+	}
+	const int n = min(steps, (int)scenario.controls.size());
+	scenario.controls.resize(n);
+	scenario.gt.resize(n);
+	scenario.observations.resize(n);
+	for (int i = 0; i < n; i++) {
+		ostringstream file;
+		file << data_dir << "/observation/observations_" << setfill('0') << setw(6) << i+1 << ".txt";
+		if (!read_landmark_data(file.str(), scenario.observations[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Builds a synthetic scenario: landmarks spread uniformly at the density of the
+ * bundled map (about one per 1000 m^2) and a vehicle circling the map center,
+ * observing the landmarks within sensor range with Gaussian noise.
+ * @param num_landmarks Number of landmarks
+ * @param steps Number of time steps
+ */
+void make_synthetic(int num_landmarks, int steps, unsigned int seed, Scenario& scenario) {
+	scenario.name = "synthetic";
+
+	mt19937 gen(seed);
+	const double side = sqrt(1000.0 * num_landmarks);
+	uniform_real_distribution<double> coordinate(0.0, side);
+	normal_distribution<double> noise_x(0, sigma_landmark[0]);
+	normal_distribution<double> noise_y(0, sigma_landmark[1]);
+
+	scenario.map.landmark_list.resize(num_landmarks);
+	for (int i = 0; i < num_landmarks; i++) {
+		scenario.map.landmark_list[i].id_i = i + 1;
+		scenario.map.landmark_list[i].x_f = coordinate(gen);
+		scenario.map.landmark_list[i].y_f = coordinate(gen);
+	}
+	scenario.map.buildIndex();
+
+	// circle of a quarter of the map side around the center at 10 m/s
+	const double radius = side / 4;
+	const double velocity = 10;
+	const double yaw_rate = velocity / radius;
+	ground_truth pose;
+	pose.x = side / 2 + radius;
+	pose.y = side / 2;
+	pose.theta = M_PI / 2;
+
+	vector<int> in_range;
+	scenario.controls.resize(steps);
+	scenario.gt.resize(steps);
+	scenario.observations.resize(steps);
+	for (int i = 0; i < steps; i++) {
+		scenario.gt[i] = pose;
+		scenario.controls[i].velocity = velocity;
+		scenario.controls[i].yawrate = yaw_rate;
+
+		scenario.map.index.query(pose.x, pose.y, sensor_range, in_range);
+		for (int j = 0; j < in_range.size(); j++) {
+			const Map::single_landmark_s& landmark = scenario.map.landmark_list[in_range[j]];
+			const double dx = landmark.x_f - pose.x;
+			const double dy = landmark.y_f - pose.y;
+			LandmarkObs obs;
+			obs.id = -1;
+			obs.x = dx * cos(pose.theta) + dy * sin(pose.theta) + noise_x(gen);
+			obs.y = -dx * sin(pose.theta) + dy * cos(pose.theta) + noise_y(gen);
+			scenario.observations[i].push_back(obs);
+		}
+
+		pose.x += radius * (sin(pose.theta + yaw_rate * delta_t) - sin(pose.theta));
+		pose.y += radius * (cos(pose.theta) - cos(pose.theta + yaw_rate * delta_t));
+		pose.theta += yaw_rate * delta_t;
+	}
+}
+
+/* Reads a field of /proc/self/status in kB, -1 where there is none.
+ */
+long read_status_kb(const string& field) {
+	ifstream status("/proc/self/status");
+	string line;
+	while (getline(status, line)) {
+		if (line.compare(0, field.size(), field) == 0 && line.size() > field.size() && line[field.size()] == ':') {
+			return atol(line.c_str() + field.size() + 1);
+		}
+	}
+	return -1;
+}
+
+/* Value below which the fraction p of the sorted samples lie, nearest rank.
+ */
+double percentile(const vector<double>& sorted, double p) {
+	if (sorted.empty()) {
+		return 0;
+	}
+	int rank = (int)ceil(p * sorted.size()) - 1;
+	return sorted[min(max(rank, 0), (int)sorted.size() - 1)];
+}
+
+enum Stage { kPrediction, kUpdateWeights, kResample, kStages };
+const char* stage_names[kStages] = {"prediction", "updateWeights", "resample"};
+
+/* Replays the scenario with a fixed number of particles and prints one row per stage.
+ * @param base_steps_per_second Steps per second the speedup is relative to, 0 for this run
+ * @output Steps per second of the run
+ */
+double run(const Scenario& scenario, int num_particles, int num_threads, double resample_threshold,
+		double base_steps_per_second) {
+	ParticleFilter pf;
+	pf.setNumThreads(num_threads);
+	pf.setParticleLimits(num_particles, num_particles);
+	pf.setResampleThreshold(resample_threshold);
+
+	vector<double> ns[kStages];
+	unsigned long long allocations[kStages] = {0, 0, 0};
+	int counted_steps = 0;
+	int resampled_steps = 0;
+	ns[kPrediction].reserve(scenario.controls.size());
+	ns[kUpdateWeights].reserve(scenario.controls.size());
+	ns[kResample].reserve(scenario.controls.size());
+	const Clock::time_point start = Clock::now();
+
+	for (int i = 0; i < scenario.controls.size(); i++) {
+		const bool counted = i >= warm_up_steps;
+		unsigned long long a0 = g_allocations;
+		if (pf.initialized()) {
+			Clock::time_point t0 = Clock::now();
+			pf.prediction(delta_t, sigma_pos, scenario.controls[i-1].velocity, scenario.controls[i-1].yawrate);
+			ns[kPrediction].push_back(chrono::duration<double, nano>(Clock::now() - t0).count());
+		}
+		else {
+			pf.init(scenario.gt[i].x, scenario.gt[i].y, scenario.gt[i].theta, sigma_pos);
+		}
+
+		unsigned long long a1 = g_allocations;
+		Clock::time_point t1 = Clock::now();
+		pf.updateWeights(sensor_range, sigma_landmark, scenario.observations[i], scenario.map);
+		Clock::time_point t2 = Clock::now();
+		unsigned long long a2 = g_allocations;
+		resampled_steps += pf.resample();
+		Clock::time_point t3 = Clock::now();
+		unsigned long long a3 = g_allocations;
+		ns[kUpdateWeights].push_back(chrono::duration<double, nano>(t2 - t1).count());
+		ns[kResample].push_back(chrono::duration<double, nano>(t3 - t2).count());
+
+		if (counted) {
+			allocations[kPrediction] += a1 - a0;
+			allocations[kUpdateWeights] += a2 - a1;
+			allocations[kResample] += a3 - a2;
+			counted_steps++;
+		}
+	}
+
+	const double seconds = chrono::duration<double>(Clock::now() - start).count();
+	const double steps_per_second = scenario.controls.size() / seconds;
+	const streamsize precision = cout.precision();
+
+	for (int s = 0; s < kStages; s++) {
+		sort(ns[s].begin(), ns[s].end());
+		double total = 0;
+		for (int i = 0; i < ns[s].size(); i++) {
+			total += ns[s][i];
+		}
+		// particles processed per second of the stage
+		const double throughput = total > 0 ? num_particles * ns[s].size() / (total * 1e-9) : 0;
+
+		cout << setw(10) << scenario.name << setw(10) << scenario.map.landmark_list.size()
+				<< setw(10) << num_particles << setw(8) << num_threads << setw(15) << stage_names[s]
+				<< fixed << setprecision(1)
+				<< setw(11) << percentile(ns[s], 0.5) * 1e-3
+				<< setw(11) << percentile(ns[s], 0.9) * 1e-3
+				<< setw(11) << percentile(ns[s], 0.99) * 1e-3
+				<< setw(11) << (ns[s].empty() ? 0.0 : ns[s].back() * 1e-3)
+				<< setprecision(2) << setw(12) << throughput * 1e-6
+				<< setw(13) << (counted_steps > 0 ? allocations[s] / (double)counted_steps : 0.0);
+		if (s == 0) {
+			cout << setw(10) << setprecision(3) << steps_per_second
+					<< setw(9) << setprecision(2)
+					<< (base_steps_per_second > 0 ? steps_per_second / base_steps_per_second : 1.0)
+					<< setw(11) << pf.memoryUsage() / (1024.0 * 1024.0);
+		}
+		if (s == kResample) {
+			cout << setw(41) << setprecision(1) << 100.0 * resampled_steps / scenario.controls.size();
+		}
+		cout << endl;
+		cout.unsetf(ios::floatfield);
+		cout.precision(precision);
+	}
+	return steps_per_second;
+}
+
+/* Parses a comma separated list of counts, e.g. "100,1000".
+ */
+vector<int> parse_counts(const string& list) {
+	vector<int> counts;
+	istringstream in(list);
+	string item;
+	while (getline(in, item, ',')) {
+		counts.push_back(atoi(item.c_str()));
+	}
+	return counts;
+}
+
+int main(int argc, char* argv[]) {
+	string usage_instructions = "Usage instructions: ";
+	usage_instructions += argv[0];
+	usage_instructions += " [-p particle_counts] [-l landmark_counts] [-s steps] [-t thread_counts] [-r resample_threshold] [-d data_dir]";
+
+	vector<int> particle_counts = parse_counts("100,1000,10000,100000,1000000");
+	vector<int> landmark_counts = parse_counts("1000,10000,100000");
+	int steps = 20;
+	// powers of two up to the hardware threads, and the hardware threads
+	const int hardware_threads = max(1u, thread::hardware_concurrency());
+	vector<int> thread_counts;
+	for (int t = 1; t < hardware_threads; t *= 2) {
+		thread_counts.push_back(t);
+	}
+	thread_counts.push_back(hardware_threads);
+	double resample_threshold = 0.5;
+	string data_dir = "data";
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (i + 1 < argc && arg == "-p") {
+			particle_counts = parse_counts(argv[++i]);
+		}
+		else if (i + 1 < argc && arg == "-l") {
+			landmark_counts = parse_counts(argv[++i]);
+		}
+		else if (i + 1 < argc && arg == "-s") {
+			steps = max(2, atoi(argv[++i]));
+		}
+		else if (i + 1 < argc && arg == "-t") {
+			thread_counts = parse_counts(argv[++i]);
+		}
+		else if (i + 1 < argc && arg == "-r") {
+			resample_threshold = atof(argv[++i]);
+		}
+		else if (i + 1 < argc && arg == "-d") {
+			data_dir = argv[++i];
+		}
+		else {
+			cerr << usage_instructions << endl;
+			return -1;
+		}
+	}
+
+	for (int i = 0; i < thread_counts.size(); i++) {
+		thread_counts[i] = max(1, thread_counts[i]);
+	}
+
+	vector<Scenario> scenarios;
+	scenarios.push_back(Scenario());
+	if (!read_bundled(data_dir, steps, scenarios.back())) {
+		cout << "Bundled data not found in " << data_dir << ", running synthetic maps only" << endl;
+		scenarios.pop_back();
+	}
+	for (int i = 0; i < landmark_counts.size(); i++) {
+		scenarios.push_back(Scenario());
+		make_synthetic(landmark_counts[i], steps, 42, scenarios.back());
+	}
+
+	cout << steps << " time steps, " << hardware_threads << " hardware threads; latencies in us, throughput in"
+			<< " million particles per second, heap allocations per step after " << warm_up_steps
+			<< " warm-up steps, steps per second relative to " << thread_counts[0] << " threads, buffers held by the filter in MB, percentage of steps resampled with an effective"
+			<< " sample size below " << resample_threshold << " N" << endl;
+	cout << setw(10) << "map" << setw(10) << "landmarks" << setw(10) << "particles" << setw(8) << "threads" << setw(15) << "stage"
+			<< setw(11) << "p50" << setw(11) << "p90" << setw(11) << "p99" << setw(11) << "max"
+			<< setw(12) << "Mparticle/s" << setw(13) << "allocs/step" << setw(10) << "steps/s" << setw(9) << "speedup" << setw(11) << "filter MB"
+			<< setw(11) << "resampled" << endl;
+
+	for (int i = 0; i < scenarios.size(); i++) {
+		for (int j = 0; j < particle_counts.size(); j++) {
+			double base = 0;
+			for (int k = 0; k < thread_counts.size(); k++) {
+				const double steps_per_second = run(scenarios[i], particle_counts[j], thread_counts[k],
+						resample_threshold, base);
+				if (k == 0) {
+					base = steps_per_second;
+				}
+			}
+		}
+	}
+
+	const long peak = read_status_kb("VmHWM");
+	if (peak >= 0) {
+		cout << "Peak process RSS " << peak / 1024.0 << " MB" << endl;
+	}
+	return 0;
+}
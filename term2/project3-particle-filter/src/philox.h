@@ -0,0 +1,108 @@
+/*
+ * philox.h
+ * Counter-based random number engine (Philox4x32-10).
+ */
+
+#ifndef PHILOX_H_
+#define PHILOX_H_
+
+#include <stdint.h>
+
+/*
+ * Philox4x32-10 of Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"
+ * (SC 2011). Every output block is a keyed bijection of a 128 bit counter, so
+ * a stream is fully determined by (seed, a, b) and any number of streams can
+ * be drawn independently and in any order, e.g. one per chunk of particles.
+ *
+ * Meets the UniformRandomBitGenerator requirements, so it works with the
+ * <random> distributions.
+ */
+class Philox4x32 {
+public:
+
+	typedef uint32_t result_type;
+
+	/**
+	 * Constructor
+	 * @param seed Key of the generator
+	 * @param a, b Stream identifiers, e.g. time step and chunk
+	 */
+	Philox4x32(uint64_t seed = 0, uint32_t a = 0, uint32_t b = 0) : position(4) {
+		key[0] = (uint32_t)seed;
+		key[1] = (uint32_t)(seed >> 32);
+		counter[0] = 0;
+		counter[1] = 0;
+		counter[2] = a;
+		counter[3] = b;
+	}
+
+	static result_type min() { return 0; }
+	static result_type max() { return 0xFFFFFFFFu; }
+
+	result_type operator()() {
+		if (position == 4) {
+			block(counter, key, output);
+			// 64 bit block counter in the first two words
+			if (++counter[0] == 0) {
+				counter[1]++;
+			}
+			position = 0;
+		}
+		return output[position++];
+	}
+
+	/**
+	 * block Computes the 4 outputs of one counter value.
+	 */
+	static void block(const uint32_t ctr_in[4], const uint32_t key_in[2], uint32_t out[4]) {
+		out[0] = ctr_in[0];
+		out[1] = ctr_in[1];
+		out[2] = ctr_in[2];
+		out[3] = ctr_in[3];
+		block(out[0], out[1], out[2], out[3], key_in[0], key_in[1]);
+	}
+
+	/**
+	 * block Replaces the counter words c0..c3 with their outputs. Takes scalars so
+	 *   vectorized loops over blocks keep everything in registers.
+	 */
+	static void block(uint32_t& c0, uint32_t& c1, uint32_t& c2, uint32_t& c3, uint32_t k0, uint32_t k1) {
+		// written out rather than looped, so callers' loops over blocks stay free of
+		// inner loops and can be vectorized
+		round(c0, c1, c2, c3, k0, k1);
+		round(c0, c1, c2, c3, k0, k1);
+		round(c0, c1, c2, c3, k0, k1);
+		round(c0, c1, c2, c3, k0, k1);
+		round(c0, c1, c2, c3, k0, k1);
+		round(c0, c1, c2, c3, k0, k1);
+		round(c0, c1, c2, c3, k0, k1);
+		round(c0, c1, c2, c3, k0, k1);
+		round(c0, c1, c2, c3, k0, k1);
+		round(c0, c1, c2, c3, k0, k1);
+	}
+
+private:
+
+	/**
+	 * round One round: two 32x32 -> 64 bit products, then a key bump.
+	 */
+	static void round(uint32_t& c0, uint32_t& c1, uint32_t& c2, uint32_t& c3, uint32_t& k0, uint32_t& k1) {
+		const uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+		const uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+		const uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+		const uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+		c1 = (uint32_t)p1;
+		c3 = (uint32_t)p0;
+		c0 = n0;
+		c2 = n2;
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+
+	uint32_t key[2];
+	uint32_t counter[4];
+	uint32_t output[4];
+	int position;
+};
+
+#endif /* PHILOX_H_ */
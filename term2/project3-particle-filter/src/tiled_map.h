@@ -0,0 +1,422 @@
+/*
+ * tiled_map.h
+ * Landmark map split into square tiles, paged in from a mapped file.
+ */
+
+#ifndef TILED_MAP_H_
+#define TILED_MAP_H_
+
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "map.h"
+
+/*
+ * Layout of a tiled map file, all in native byte order:
+ *
+ *   TiledMapHeader
+ *   uint64_t[tiles_x * tiles_y + 1]        landmarks of tile t are [index[t], index[t + 1])
+ *   Map::single_landmark_s[num_landmarks]   ordered by tile, rows of tiles from origin_y up
+ *
+ * Tile (tx, ty) covers [origin_x + tx * tile_size, origin_x + (tx + 1) * tile_size)
+ * and the same in y.
+ */
+struct TiledMapHeader {
+
+	char magic[8];					// "PFTILES" plus format version
+	double origin_x;				// Map coordinates of the lower left corner of tile (0, 0)
+	double origin_y;
+	double tile_size;				// Edge length of the tiles [m]
+	uint32_t tiles_x;				// Tiles per row and number of rows
+	uint32_t tiles_y;
+	uint64_t num_landmarks;
+	uint64_t index_offset;			// Byte offsets of the sections from the start of the file
+	uint64_t landmarks_offset;
+	uint64_t file_size;
+};
+
+const char kTiledMapMagic[8] = {'P', 'F', 'T', 'I', 'L', 'E', 'S', '1'};
+
+/* Writes a tiled map file.
+ * @param filename Name of the file to write
+ * @param map Map with the landmarks
+ * @param tile_size Edge length of the tiles [m], a few sensor ranges keeps the tiles few per query
+ * @output True if writing the file was successful
+ */
+inline bool write_tiled_map(std::string filename, const Map& map, double tile_size) {
+
+	const std::vector<Map::single_landmark_s>& landmarks = map.landmark_list;
+	if (tile_size <= 0) {
+		return false;
+	}
+
+	TiledMapHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kTiledMapMagic, sizeof(header.magic));
+	header.tile_size = tile_size;
+	header.num_landmarks = landmarks.size();
+
+	// tiles from the lower left corner of the bounding box
+	double max_x = 0, max_y = 0;
+	if (!landmarks.empty()) {
+		header.origin_x = max_x = landmarks[0].x_f;
+		header.origin_y = max_y = landmarks[0].y_f;
+	}
+	for (int i = 1; i < landmarks.size(); i++) {
+		header.origin_x = std::min(header.origin_x, (double)landmarks[i].x_f);
+		header.origin_y = std::min(header.origin_y, (double)landmarks[i].y_f);
+		max_x = std::max(max_x, (double)landmarks[i].x_f);
+		max_y = std::max(max_y, (double)landmarks[i].y_f);
+	}
+	header.tiles_x = (uint32_t)((max_x - header.origin_x) / tile_size) + 1;
+	header.tiles_y = (uint32_t)((max_y - header.origin_y) / tile_size) + 1;
+	const size_t num_tiles = (size_t)header.tiles_x * header.tiles_y;
+
+	// counting sort by tile
+	std::vector<uint64_t> tiles(landmarks.size());
+	std::vector<uint64_t> index(num_tiles + 1, 0);
+	for (int i = 0; i < landmarks.size(); i++) {
+		const uint64_t tx = std::min((uint64_t)((landmarks[i].x_f - header.origin_x) / tile_size), (uint64_t)header.tiles_x - 1);
+		const uint64_t ty = std::min((uint64_t)((landmarks[i].y_f - header.origin_y) / tile_size), (uint64_t)header.tiles_y - 1);
+		tiles[i] = tx + header.tiles_x * ty;
+		index[tiles[i] + 1]++;
+	}
+	for (size_t t = 0; t < num_tiles; t++) {
+		index[t + 1] += index[t];
+	}
+	std::vector<uint64_t> next(index.begin(), index.end() - 1);
+	std::vector<Map::single_landmark_s> sorted(landmarks.size());
+	for (int i = 0; i < landmarks.size(); i++) {
+		sorted[next[tiles[i]]++] = landmarks[i];
+	}
+
+	header.index_offset = sizeof(TiledMapHeader);
+	header.landmarks_offset = header.index_offset + index.size() * sizeof(uint64_t);
+	header.file_size = header.landmarks_offset + sorted.size() * sizeof(Map::single_landmark_s);
+
+	std::ofstream out(filename.c_str(), std::ios::binary);
+	if (!out) {
+		return false;
+	}
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)index.data(), index.size() * sizeof(uint64_t));
+	out.write((const char*)sorted.data(), sorted.size() * sizeof(Map::single_landmark_s));
+	return (bool)out;
+}
+
+/*
+ * Read-only memory mapping of a tiled map file with a cache of loaded tiles.
+ * page loads the tiles overlapping a box, each with its own LandmarkIndex
+ * over the landmarks it maps in place, and evicts the least recently used
+ * tiles beyond the cache size. Memory is the cached tiles plus the file
+ * pages they touch, so it follows the neighborhood, not the map.
+ *
+ * Queries only see loaded tiles: page the area before querying in it.
+ */
+class TiledMap {
+public:
+
+	TiledMap() : data(NULL), size(0), header(NULL), max_tiles(0), clock(0) {}
+
+	~TiledMap() {
+		close();
+	}
+
+	/**
+	 * open Maps a tiled map file and checks its header.
+	 * @param filename Name of the file written by write_tiled_map
+	 * @param cache_tiles Number of tiles kept loaded; a box of more tiles exceeds it until the next page
+	 * @output True if the file is a valid tiled map
+	 */
+	bool open(std::string filename, int cache_tiles) {
+		close();
+
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TiledMapHeader)) {
+			::close(fd);
+			return false;
+		}
+		void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (mapped == MAP_FAILED) {
+			return false;
+		}
+		data = (const char*)mapped;
+		size = st.st_size;
+		header = (const TiledMapHeader*)data;
+
+		// tiles are numbered with ints, tile_slot has one entry per tile
+		const uint64_t num_tiles = (uint64_t)header->tiles_x * header->tiles_y;
+		if (memcmp(header->magic, kTiledMapMagic, sizeof(kTiledMapMagic)) != 0 || header->file_size != size
+				|| !(header->tile_size > 0) || num_tiles == 0 || num_tiles >= INT_MAX
+				|| header->index_offset > size || header->index_offset % 8 != 0
+				|| num_tiles + 1 > (size - header->index_offset) / sizeof(uint64_t)
+				|| header->landmarks_offset > size || header->landmarks_offset % 4 != 0
+				|| header->num_landmarks > (size - header->landmarks_offset) / sizeof(Map::single_landmark_s)
+				|| !validIndex(num_tiles)) {
+			close();
+			return false;
+		}
+
+		max_tiles = std::max(1, cache_tiles);
+		tile_slot.assign(num_tiles, -1);
+		return true;
+	}
+
+	/**
+	 * close Drops the loaded tiles and unmaps the file.
+	 */
+	void close() {
+		if (data != NULL) {
+			munmap((void*)data, size);
+		}
+		data = NULL;
+		size = 0;
+		header = NULL;
+		slots.clear();
+		tile_slot.clear();
+	}
+
+	/**
+	 * isOpen Returns whether a tiled map is mapped.
+	 */
+	bool isOpen() const {
+		return data != NULL;
+	}
+
+	/**
+	 * page Loads the tiles overlapping the box and marks them most recently used.
+	 * @param min_x, min_y, max_x, max_y Box in map coordinates [m]
+	 */
+	void page(double min_x, double min_y, double max_x, double max_y) {
+		int tx0, ty0, tx1, ty1;
+		if (!tileRange(min_x, min_y, max_x, max_y, tx0, ty0, tx1, ty1)) {
+			return;
+		}
+		clock++;
+
+		// a previous box of more tiles than the cache grew it, shrink it back first
+		trim();
+
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) {
+				const int64_t tile = tileNumber(tx, ty);
+				if (tile_slot[tile] >= 0) {
+					slots[tile_slot[tile]].last_used = clock;
+				}
+				else if (index()[tile + 1] > index()[tile]) {
+					load(tile);
+				}
+			}
+		}
+	}
+
+	/**
+	 * forEachInRange Calls visit(id, x, y) for every landmark of the loaded tiles within
+	 *   range of (x, y).
+	 */
+	template <typename Visitor>
+	void forEachInRange(double x, double y, double range, Visitor visit) const {
+		int tx0, ty0, tx1, ty1;
+		if (!tileRange(x - range, y - range, x + range, y + range, tx0, ty0, tx1, ty1)) {
+			return;
+		}
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) {
+				const int slot = tile_slot[tileNumber(tx, ty)];
+				if (slot < 0) {
+					continue;
+				}
+				const Map::single_landmark_s* landmarks = slots[slot].landmarks;
+				slots[slot].index.forEachInRange(x, y, range, [&](int k, float lx, float ly) {
+					visit(landmarks[k].id_i, lx, ly);
+				});
+			}
+		}
+	}
+
+	/**
+	 * loadedTiles Number of tiles in the cache.
+	 */
+	int loadedTiles() const {
+		return slots.size();
+	}
+
+	/**
+	 * loadedLandmarks Number of landmarks of the tiles in the cache.
+	 */
+	size_t loadedLandmarks() const {
+		size_t count = 0;
+		for (int i = 0; i < slots.size(); i++) {
+			count += slots[i].count;
+		}
+		return count;
+	}
+
+	/**
+	 * numLandmarks Number of landmarks of the whole map.
+	 */
+	size_t numLandmarks() const {
+		return header->num_landmarks;
+	}
+
+private:
+
+	// A loaded tile, its landmarks are read in place from the mapping
+	struct Tile {
+		int64_t tile;
+		uint64_t last_used;
+		const Map::single_landmark_s* landmarks;
+		int count;
+		LandmarkIndex index;
+	};
+
+	// the mapping is owned, no copies
+	TiledMap(const TiledMap&);
+	TiledMap& operator=(const TiledMap&);
+
+	const uint64_t* index() const {
+		return (const uint64_t*)(data + header->index_offset);
+	}
+
+	/**
+	 * validIndex Returns whether the tile index starts at 0, never decreases and ends at
+	 *   num_landmarks.
+	 */
+	bool validIndex(uint64_t num_tiles) const {
+		const uint64_t* tiles = index();
+		if (tiles[0] != 0 || tiles[num_tiles] != header->num_landmarks) {
+			return false;
+		}
+		for (uint64_t t = 0; t < num_tiles; t++) {
+			if (tiles[t + 1] < tiles[t]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * tileNumber Row major number of tile (tx, ty), below INT_MAX for a map open checked.
+	 */
+	int64_t tileNumber(int tx, int ty) const {
+		return tx + (int64_t)header->tiles_x * ty;
+	}
+
+	/**
+	 * tileRange Tiles overlapping the box, clamped to the map.
+	 * @output False if the box is off the map
+	 */
+	bool tileRange(double min_x, double min_y, double max_x, double max_y, int& tx0, int& ty0, int& tx1, int& ty1) const {
+		if (header == NULL) {
+			return false;
+		}
+		const double x0 = floor((min_x - header->origin_x) / header->tile_size);
+		const double y0 = floor((min_y - header->origin_y) / header->tile_size);
+		const double x1 = floor((max_x - header->origin_x) / header->tile_size);
+		const double y1 = floor((max_y - header->origin_y) / header->tile_size);
+		if (x1 < 0 || y1 < 0 || x0 >= header->tiles_x || y0 >= header->tiles_y) {
+			return false;
+		}
+		tx0 = (int)std::max(x0, 0.0);
+		ty0 = (int)std::max(y0, 0.0);
+		tx1 = (int)std::min(x1, header->tiles_x - 1.0);
+		ty1 = (int)std::min(y1, header->tiles_y - 1.0);
+		return true;
+	}
+
+	/**
+	 * load Indexes a tile, in the slot of the least recently used tile once the cache is full.
+	 *   Tiles paged by the current call are not evicted, the cache grows for them instead.
+	 */
+	void load(int64_t tile) {
+		int slot = -1;
+		if (slots.size() >= max_tiles) {
+			for (int i = 0; i < slots.size(); i++) {
+				if (slots[i].last_used < clock && (slot < 0 || slots[i].last_used < slots[slot].last_used)) {
+					slot = i;
+				}
+			}
+		}
+		if (slot < 0) {
+			slot = slots.size();
+			slots.push_back(Tile());
+		}
+		else {
+			evict(slot);
+		}
+
+		Tile& t = slots[slot];
+		t.tile = tile;
+		t.last_used = clock;
+		t.landmarks = (const Map::single_landmark_s*)(data + header->landmarks_offset) + index()[tile];
+		t.count = index()[tile + 1] - index()[tile];
+		t.index.build(t.landmarks, t.count);
+		tile_slot[tile] = slot;
+	}
+
+	/**
+	 * trim Evicts least recently used tiles until the cache holds at most max_tiles.
+	 */
+	void trim() {
+		while (slots.size() > max_tiles) {
+			int slot = 0;
+			for (int i = 1; i < slots.size(); i++) {
+				if (slots[i].last_used < slots[slot].last_used) {
+					slot = i;
+				}
+			}
+			evict(slot);
+
+			// move the last tile into the freed slot
+			const int last = slots.size() - 1;
+			if (slot != last) {
+				std::swap(slots[slot], slots[last]);
+				tile_slot[slots[slot].tile] = slot;
+			}
+			slots.pop_back();
+		}
+	}
+
+	/**
+	 * evict Unloads the tile of a slot and returns its file pages to the kernel.
+	 */
+	void evict(int slot) {
+		Tile& t = slots[slot];
+		tile_slot[t.tile] = -1;
+
+		// the pages are clean and read again from the file if they are touched, so
+		// rounding out to whole pages is safe even where neighbors share a page
+		const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+		const uintptr_t begin = (uintptr_t)t.landmarks & ~(page_size - 1);
+		const uintptr_t end = ((uintptr_t)(t.landmarks + t.count) + page_size - 1) & ~(page_size - 1);
+		madvise((void*)begin, end - begin, MADV_DONTNEED);
+	}
+
+	const char* data;
+	size_t size;
+	const TiledMapHeader* header;
+
+	// Loaded tiles and the slot of each tile of the map, -1 if it is not loaded
+	std::vector<Tile> slots;
+	std::vector<int> tile_slot;
+
+	// Cache size in tiles and page calls so far, last_used of a tile is the call that paged it
+	int max_tiles;
+	uint64_t clock;
+};
+
+#endif /* TILED_MAP_H_ */
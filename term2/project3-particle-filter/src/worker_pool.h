@@ -0,0 +1,152 @@
+/*
+ * worker_pool.h
+ * Fixed set of worker threads for the particle loops.
+ */
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * run(n, task) calls task(chunk, worker) for every chunk in [0, n) and
+ * returns when all are done. The calling thread works as worker 0, so a pool
+ * of size 1 starts no threads and runs the chunks inline. Chunks are handed
+ * out in order from a shared counter; which worker runs a chunk varies, so
+ * tasks must only depend on the chunk, and use the worker index for scratch
+ * space only.
+ */
+class WorkerPool {
+public:
+
+	/**
+	 * Constructor
+	 * @param num_workers Number of workers including the calling thread, at least 1
+	 */
+	explicit WorkerPool(int num_workers = 1)
+			: invoke(NULL), context(NULL), num_chunks(0), next_chunk(0), busy(0), generation(0), stop(false) {
+		resize(num_workers);
+	}
+
+	~WorkerPool() {
+		resize(1);
+	}
+
+	/**
+	 * resize Changes the number of workers, stopping or starting threads.
+	 */
+	void resize(int num_workers) {
+		if (num_workers < 1) {
+			num_workers = 1;
+		}
+		if (num_workers == size()) {
+			return;
+		}
+
+		// stop all threads, then start the new number
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		start.notify_all();
+		for (int i = 0; i < threads.size(); i++) {
+			threads[i].join();
+		}
+		threads.clear();
+		stop = false;
+
+		for (int worker = 1; worker < num_workers; worker++) {
+			threads.push_back(std::thread(&WorkerPool::loop, this, worker, generation));
+		}
+	}
+
+	/**
+	 * size Number of workers including the calling thread.
+	 */
+	int size() const {
+		return threads.size() + 1;
+	}
+
+	/**
+	 * run Runs task(chunk, worker) for all chunks in [0, num_chunks), without allocating.
+	 */
+	template <typename Task>
+	void run(int num_chunks_in, Task& task) {
+		if (threads.empty()) {
+			for (int chunk = 0; chunk < num_chunks_in; chunk++) {
+				task(chunk, 0);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			invoke = &invokeTask<Task>;
+			context = &task;
+			num_chunks = num_chunks_in;
+			next_chunk = 0;
+			busy = threads.size();
+			generation++;
+		}
+		start.notify_all();
+
+		work(0);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return busy == 0; });
+		invoke = NULL;
+		context = NULL;
+	}
+
+private:
+
+	template <typename Task>
+	static void invokeTask(void* task, int chunk, int worker) {
+		(*static_cast<Task*>(task))(chunk, worker);
+	}
+
+	void work(int worker) {
+		for (int chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++) {
+			invoke(context, chunk, worker);
+		}
+	}
+
+	// seen is the generation at start, a run posted before the thread gets going is still picked up
+	void loop(int worker, unsigned long seen) {
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				start.wait(lock, [&] { return stop || generation != seen; });
+				if (stop) {
+					return;
+				}
+				seen = generation;
+			}
+
+			work(worker);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busy == 0) {
+				done.notify_one();
+			}
+		}
+	}
+
+	std::vector<std::thread> threads;
+	void (*invoke)(void*, int, int);
+	void* context;
+	int num_chunks;
+	std::atomic<int> next_chunk;
+	int busy;
+	unsigned long generation;
+	bool stop;
+	std::mutex mutex;
+	std::condition_variable start;
+	std::condition_variable done;
+};
+
+#endif /* WORKER_POOL_H_ */